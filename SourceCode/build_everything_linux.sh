@@ -12,6 +12,9 @@ do
 done
 
 
-  mv $(find . -name '*.so') LinuxBinaries/
+# rock-text-bundle.so holds the plug-ins of every other folder and replaces
+# their separate .so files, the two must never be installed together
+  mv rock_text_bundle/build/rock-text-bundle.so LinuxBinaries/
+  mv $(find . -path '*/build/*' -type f -perm -u+x -name 'rock-text-*' ! -name '*.so') LinuxBinaries/
 
 
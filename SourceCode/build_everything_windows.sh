@@ -52,6 +52,8 @@ do
 done
 
 
-  mv $(find . -name '*.dll') WindowsBinaries/
+# rock-text-bundle.dll holds the plug-ins of every other folder and replaces
+# their separate .dll files, the two must never be installed together
+  mv rock_text_bundle/build/rock-text-bundle.dll WindowsBinaries/
 
 
@@ -60,8 +60,599 @@ GEGL_DEFINE_DYNAMIC_OPERATION(GEGL_TYPE_OPERATION_META)
 
 #include <stdio.h>
 #include <stdlib.h>
+
+#ifdef HAVE_TIFF
+#include <tiffio.h>
+#endif
+
 #define SNIFFING_LENGTH 4096
 
+/* Local files that were resolved before are remembered here, keyed by their
+ * resolved path, so that setting the same src on many instances does not
+ * open and sniff the file again. An entry is only trusted while the fileꞌs
+ * mtime and size are unchanged. Set PORT_LOAD_CACHE_STATS to print the hit
+ * rate after every setup.
+ *
+ * Files decoded here rather than by their handler (see load_parallel) also
+ * keep the decoded buffer in their entry, so every later instance shares it.
+ */
+#define RESOLVE_CACHE_MAX_ENTRIES 64
+
+typedef struct
+{
+  gint64      mtime;
+  goffset     size;
+  gchar      *handler;
+  GeglBuffer *buffer;
+} ResolveCacheEntry;
+
+static GHashTable *resolve_cache        = NULL;
+static GMutex      resolve_cache_mutex;
+static guint       resolve_cache_hits   = 0;
+static guint       resolve_cache_misses = 0;
+
+static void
+resolve_cache_entry_free (gpointer data)
+{
+  ResolveCacheEntry *entry = data;
+
+  g_free (entry->handler);
+  g_clear_object (&entry->buffer);
+  g_free (entry);
+}
+
+/* mtime is in microseconds, so a rewrite of the same size within one
+ * second still misses.
+ */
+static gboolean
+resolve_cache_stat (const gchar *resolved_path,
+                    gint64      *mtime,
+                    goffset     *size)
+{
+  GFile     *file = g_file_new_for_path (resolved_path);
+  GFileInfo *info;
+
+  info = g_file_query_info (file,
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC ","
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  g_object_unref (file);
+  if (!info)
+    return FALSE;
+
+  *mtime = (gint64) g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+           g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+  *size  = g_file_info_get_size (info);
+  g_object_unref (info);
+  return TRUE;
+}
+
+static void
+resolve_cache_report (void)
+{
+  if (g_getenv ("PORT_LOAD_CACHE_STATS"))
+    g_message ("port:load resolve cache: %u hits, %u misses",
+               resolve_cache_hits, resolve_cache_misses);
+}
+
+/* Returns a copy of the cached handler for resolved_path, or NULL. */
+static gchar *
+resolve_cache_lookup (const gchar *resolved_path,
+                      gint64       mtime,
+                      goffset      size)
+{
+  ResolveCacheEntry *entry;
+  gchar             *handler = NULL;
+
+  g_mutex_lock (&resolve_cache_mutex);
+
+  if (resolve_cache)
+    {
+      entry = g_hash_table_lookup (resolve_cache, resolved_path);
+      if (entry && entry->mtime == mtime && entry->size == size)
+        handler = g_strdup (entry->handler);
+    }
+
+  if (handler)
+    resolve_cache_hits++;
+  else
+    resolve_cache_misses++;
+
+  g_mutex_unlock (&resolve_cache_mutex);
+
+  resolve_cache_report ();
+
+  return handler;
+}
+
+static void
+resolve_cache_insert (const gchar *resolved_path,
+                      gint64       mtime,
+                      goffset      size,
+                      const gchar *handler)
+{
+  ResolveCacheEntry *entry = g_new0 (ResolveCacheEntry, 1);
+
+  entry->mtime   = mtime;
+  entry->size    = size;
+  entry->handler = g_strdup (handler);
+
+  g_mutex_lock (&resolve_cache_mutex);
+
+  if (!resolve_cache)
+    resolve_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free, resolve_cache_entry_free);
+
+  /* The working set is a handful of overlay files; when it grows past that
+   * just start over rather than tracking recency.
+   */
+  if (g_hash_table_size (resolve_cache) >= RESOLVE_CACHE_MAX_ENTRIES)
+    g_hash_table_remove_all (resolve_cache);
+
+  g_hash_table_replace (resolve_cache, g_strdup (resolved_path), entry);
+
+  g_mutex_unlock (&resolve_cache_mutex);
+}
+
+/* Returns a reference to the decoded buffer of resolved_path, or NULL. */
+static GeglBuffer *
+resolve_cache_buffer (const gchar *resolved_path,
+                      gint64       mtime,
+                      goffset      size)
+{
+  ResolveCacheEntry *entry;
+  GeglBuffer        *buffer = NULL;
+
+  g_mutex_lock (&resolve_cache_mutex);
+
+  if (resolve_cache)
+    {
+      entry = g_hash_table_lookup (resolve_cache, resolved_path);
+      if (entry && entry->mtime == mtime && entry->size == size && entry->buffer)
+        buffer = g_object_ref (entry->buffer);
+    }
+
+  g_mutex_unlock (&resolve_cache_mutex);
+
+  return buffer;
+}
+
+/* Keeps buffer in the entry of resolved_path, unless the file changed since
+ * or another instance got there first. Returns a reference to the buffer to
+ * use, which is the one already in the entry in the second case.
+ */
+static GeglBuffer *
+resolve_cache_share_buffer (const gchar *resolved_path,
+                            gint64       mtime,
+                            goffset      size,
+                            GeglBuffer  *buffer)
+{
+  ResolveCacheEntry *entry;
+
+  g_mutex_lock (&resolve_cache_mutex);
+
+  entry = resolve_cache ? g_hash_table_lookup (resolve_cache, resolved_path) : NULL;
+  if (entry && entry->mtime == mtime && entry->size == size)
+    {
+      if (!entry->buffer)
+        entry->buffer = g_object_ref (buffer);
+      buffer = entry->buffer;
+    }
+  buffer = g_object_ref (buffer);
+
+  g_mutex_unlock (&resolve_cache_mutex);
+
+  return buffer;
+}
+
+#ifdef HAVE_TIFF
+/* Large TIFF files are decoded here instead of by gegl:tiff-load: strips or
+ * tiles are compressed one by one, so every thread opens the file for
+ * itself, takes the next strip or tile, decodes it and writes it straight
+ * into one GeglBuffer, which PortTiffSource below hands on. Files that do
+ * not fit the simple layouts below, or are smaller than this, are left to
+ * gegl:tiff-load. JPEG and PNG are always left to their handler: PNG is one
+ * deflate stream and libjpeg has no way to start at a restart marker, so
+ * neither splits into parts that decode on their own.
+ */
+#define PARALLEL_TIFF_MIN_PIXELS (4 * 1024 * 1024)
+
+typedef struct
+{
+  const gchar *path;
+  GeglBuffer  *buffer;
+  const Babl  *format;
+  gboolean     tiled;
+  guint32      width;
+  guint32      height;
+  guint32      unit_width;    /* tile size, or the width and rows of a strip */
+  guint32      unit_height;
+  guint32      units_across;
+  gint         n_units;
+  gint         next;          /* atomic, the next strip or tile to decode */
+  gint         failed;        /* atomic */
+} TiffDecode;
+
+static gpointer
+tiff_decode_thread (gpointer data)
+{
+  TiffDecode *decode = data;
+  TIFF       *tif    = TIFFOpen (decode->path, "r");
+  guchar     *pixels = NULL;
+  tmsize_t    unit_size = 0, rowstride = 0;
+  gint        unit;
+
+  if (tif)
+    {
+      unit_size = decode->tiled ? TIFFTileSize (tif) : TIFFStripSize (tif);
+      rowstride = decode->tiled ? TIFFTileRowSize (tif) : TIFFScanlineSize (tif);
+      pixels    = g_try_malloc (unit_size);
+    }
+
+  if (!pixels)
+    g_atomic_int_set (&decode->failed, 1);
+
+  while (pixels && !g_atomic_int_get (&decode->failed) &&
+         (unit = g_atomic_int_add (&decode->next, 1)) < decode->n_units)
+    {
+      GeglRectangle rect;
+      tmsize_t      got;
+
+      if (decode->tiled)
+        {
+          rect.x = (unit % decode->units_across) * decode->unit_width;
+          rect.y = (unit / decode->units_across) * decode->unit_height;
+          got    = TIFFReadEncodedTile (tif, unit, pixels, unit_size);
+        }
+      else
+        {
+          rect.x = 0;
+          rect.y = unit * decode->unit_height;
+          got    = TIFFReadEncodedStrip (tif, unit, pixels, unit_size);
+        }
+      /* Tiles on the right and bottom edges are padded to the full size */
+      rect.width  = MIN (decode->unit_width,  decode->width  - rect.x);
+      rect.height = MIN (decode->unit_height, decode->height - rect.y);
+
+      if (got < 0)
+        g_atomic_int_set (&decode->failed, 1);
+      else
+        gegl_buffer_set (decode->buffer, &rect, 0, decode->format, pixels, rowstride);
+    }
+
+  g_free (pixels);
+  if (tif)
+    TIFFClose (tif);
+
+  return NULL;
+}
+
+/* The babl format of a TIFF layout this loader handles, or NULL */
+static const Babl *
+tiff_format (TIFF *tif)
+{
+  guint16  bps = 0, spp = 0, photometric = 0, planar = 0, sampleformat = 0;
+  guint16  orientation = 0, n_extra = 0;
+  guint16 *extra = NULL;
+  guint32  icc_length;
+  void    *icc;
+  gboolean associated;
+  const gchar *model;
+  gchar   *name;
+  const Babl *format;
+
+  TIFFGetFieldDefaulted (tif, TIFFTAG_BITSPERSAMPLE, &bps);
+  TIFFGetFieldDefaulted (tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+  TIFFGetFieldDefaulted (tif, TIFFTAG_PLANARCONFIG, &planar);
+  TIFFGetFieldDefaulted (tif, TIFFTAG_SAMPLEFORMAT, &sampleformat);
+  TIFFGetFieldDefaulted (tif, TIFFTAG_ORIENTATION, &orientation);
+  TIFFGetFieldDefaulted (tif, TIFFTAG_EXTRASAMPLES, &n_extra, &extra);
+
+  /* Anything gegl:tiff-load would convert or flip stays with it */
+  if (!TIFFGetField (tif, TIFFTAG_PHOTOMETRIC, &photometric) ||
+      TIFFGetField (tif, TIFFTAG_ICCPROFILE, &icc_length, &icc) ||
+      planar != PLANARCONFIG_CONTIG ||
+      sampleformat != SAMPLEFORMAT_UINT ||
+      orientation != ORIENTATION_TOPLEFT ||
+      (bps != 8 && bps != 16))
+    return NULL;
+
+  associated = n_extra > 0 && extra[0] == EXTRASAMPLE_ASSOCALPHA;
+
+  if (photometric == PHOTOMETRIC_MINISBLACK && spp == 1)
+    model = "Y'";
+  else if (photometric == PHOTOMETRIC_MINISBLACK && spp == 2)
+    model = associated ? "Y'aA" : "Y'A";
+  else if (photometric == PHOTOMETRIC_RGB && spp == 3)
+    model = "R'G'B'";
+  else if (photometric == PHOTOMETRIC_RGB && spp == 4)
+    model = associated ? "R'aG'aB'aA" : "R'G'B'A";
+  else
+    return NULL;
+
+  name   = g_strdup_printf ("%s %s", model, bps == 8 ? "u8" : "u16");
+  format = babl_format (name);
+  g_free (name);
+
+  return format;
+}
+
+/* Reads the header of path into decode. FALSE when it is not a TIFF this
+ * loader handles.
+ */
+static gboolean
+parallel_tiff_open (const gchar *path,
+                    TiffDecode  *decode)
+{
+  TIFF    *tif;
+  guint32  rows_per_strip = 0;
+
+  tif = TIFFOpen (path, "r");
+  if (!tif)
+    return FALSE;
+
+  decode->path   = path;
+  decode->format = tiff_format (tif);
+  decode->tiled  = TIFFIsTiled (tif);
+  TIFFGetField (tif, TIFFTAG_IMAGEWIDTH,  &decode->width);
+  TIFFGetField (tif, TIFFTAG_IMAGELENGTH, &decode->height);
+
+  if (decode->tiled)
+    {
+      TIFFGetField (tif, TIFFTAG_TILEWIDTH,  &decode->unit_width);
+      TIFFGetField (tif, TIFFTAG_TILELENGTH, &decode->unit_height);
+      decode->n_units = (gint) TIFFNumberOfTiles (tif);
+    }
+  else
+    {
+      TIFFGetFieldDefaulted (tif, TIFFTAG_ROWSPERSTRIP, &rows_per_strip);
+      decode->unit_width  = decode->width;
+      decode->unit_height = MIN (rows_per_strip, decode->height);
+      decode->n_units     = (gint) TIFFNumberOfStrips (tif);
+    }
+  TIFFClose (tif);
+
+  if (!decode->format || decode->n_units < 2 ||
+      decode->unit_width == 0 || decode->unit_height == 0 ||
+      (guint64) decode->width * decode->height < PARALLEL_TIFF_MIN_PIXELS)
+    return FALSE;
+
+  decode->units_across = (decode->width + decode->unit_width - 1) / decode->unit_width;
+  return TRUE;
+}
+
+/* Decodes a file opened with parallel_tiff_open on as many threads as it has
+ * strips or tiles, up to the number of processors. NULL when it fails.
+ */
+static GeglBuffer *
+parallel_tiff_decode (TiffDecode *decode)
+{
+  GThread **threads;
+  gint      n_threads, i;
+
+  decode->next   = 0;
+  decode->failed = 0;
+  decode->buffer = gegl_buffer_new (GEGL_RECTANGLE (0, 0, decode->width, decode->height),
+                                    decode->format);
+
+  n_threads = MIN ((gint) g_get_num_processors (), decode->n_units);
+  threads   = g_new (GThread *, n_threads);
+  for (i = 0; i < n_threads; i++)
+    threads[i] = g_thread_new ("port-load-tiff", tiff_decode_thread, decode);
+  for (i = 0; i < n_threads; i++)
+    g_thread_join (threads[i]);
+  g_free (threads);
+
+  if (decode->failed)
+    g_clear_object (&decode->buffer);
+
+  return g_steal_pointer (&decode->buffer);
+}
+
+/* The load node of a TIFF that is decoded here. Setting it up only reads the
+ * header; the file is decoded the first time the node is processed, so that
+ * setting src does not block, and the result goes to the resolve cache for
+ * the next instance.
+ */
+typedef struct
+{
+  GeglOperationSource parent_instance;
+
+  GMutex      mutex;
+  TiffDecode  decode;
+  gchar      *path;
+  gchar      *resolved_path;  /* NULL when the file is not in the resolve cache */
+  gint64      mtime;
+  goffset     size;
+  GeglBuffer *buffer;
+} PortTiffSource;
+
+typedef struct
+{
+  GeglOperationSourceClass parent_class;
+} PortTiffSourceClass;
+
+G_DEFINE_DYNAMIC_TYPE (PortTiffSource, port_tiff_source, GEGL_TYPE_OPERATION_SOURCE)
+
+static void
+port_tiff_source_init (PortTiffSource *self)
+{
+  g_mutex_init (&self->mutex);
+}
+
+static void
+port_tiff_source_finalize (GObject *object)
+{
+  PortTiffSource *self = (PortTiffSource *) object;
+
+  g_clear_object (&self->buffer);
+  g_free (self->path);
+  g_free (self->resolved_path);
+  g_mutex_clear (&self->mutex);
+
+  G_OBJECT_CLASS (port_tiff_source_parent_class)->finalize (object);
+}
+
+static void
+port_tiff_source_prepare (GeglOperation *operation)
+{
+  PortTiffSource *self = (PortTiffSource *) operation;
+
+  gegl_operation_set_format (operation, "output", self->decode.format);
+}
+
+static GeglRectangle
+port_tiff_source_get_bounding_box (GeglOperation *operation)
+{
+  PortTiffSource *self = (PortTiffSource *) operation;
+
+  return *GEGL_RECTANGLE (0, 0, self->decode.width, self->decode.height);
+}
+
+/* Hands the whole decoded buffer on, like gegl:buffer-source */
+static gboolean
+port_tiff_source_process (GeglOperation        *operation,
+                          GeglOperationContext *context,
+                          const gchar          *output_pad,
+                          const GeglRectangle  *result,
+                          gint                  level)
+{
+  PortTiffSource *self = (PortTiffSource *) operation;
+  GeglBuffer     *buffer;
+
+  g_mutex_lock (&self->mutex);
+
+  if (!self->buffer)
+    {
+      buffer = parallel_tiff_decode (&self->decode);
+
+      /* A file that only fails halfway through stays transparent */
+      if (!buffer)
+        {
+          g_warning ("%s could not be decoded", self->path);
+          buffer = gegl_buffer_new (GEGL_RECTANGLE (0, 0, self->decode.width,
+                                                    self->decode.height),
+                                    self->decode.format);
+        }
+      else if (self->resolved_path)
+        {
+          GeglBuffer *shared = resolve_cache_share_buffer (self->resolved_path,
+                                                           self->mtime, self->size,
+                                                           buffer);
+          g_object_unref (buffer);
+          buffer = shared;
+        }
+
+      self->buffer = buffer;
+    }
+
+  gegl_operation_context_take_object (context, "output",
+                                      G_OBJECT (g_object_ref (self->buffer)));
+
+  g_mutex_unlock (&self->mutex);
+
+  return TRUE;
+}
+
+static void
+port_tiff_source_class_init (PortTiffSourceClass *klass)
+{
+  GObjectClass       *object_class    = G_OBJECT_CLASS (klass);
+  GeglOperationClass *operation_class = GEGL_OPERATION_CLASS (klass);
+
+  object_class->finalize = port_tiff_source_finalize;
+
+  operation_class->prepare          = port_tiff_source_prepare;
+  operation_class->get_bounding_box = port_tiff_source_get_bounding_box;
+  operation_class->process          = port_tiff_source_process;
+  operation_class->threaded         = FALSE;
+  operation_class->no_cache         = TRUE;
+
+  gegl_operation_class_set_keys (operation_class,
+    "name",       "port:tiff-source",
+    "categories", "hidden",
+    "description", _("Large TIFF file decoded in parallel on first use, made by port:load"),
+    NULL);
+}
+
+static void
+port_tiff_source_class_finalize (PortTiffSourceClass *klass)
+{
+}
+
+/* A PortTiffSource for path, or NULL when it is not a TIFF this loader handles */
+static GeglOperation *
+port_tiff_source_new (const gchar *path,
+                      const gchar *resolved_path,
+                      gint64       mtime,
+                      goffset      size)
+{
+  PortTiffSource *self = g_object_new (port_tiff_source_get_type (), NULL);
+
+  self->path          = g_strdup (path);
+  self->resolved_path = g_strdup (resolved_path);
+  self->mtime         = mtime;
+  self->size          = size;
+
+  if (!parallel_tiff_open (self->path, &self->decode))
+    {
+      g_object_unref (self);
+      return NULL;
+    }
+
+  return GEGL_OPERATION (self);
+}
+#endif
+
+/* Decodes path here, on several threads, when handler is a loader whose
+ * files split into parts that decode on their own: the load node becomes a
+ * buffer source of what another instance already decoded, or else a
+ * PortTiffSource that decodes when it is first processed. resolved_path,
+ * mtime and size find the result in the resolve cache, resolved_path is NULL
+ * for files that are not in it. FALSE leaves it to handler.
+ */
+static gboolean
+load_parallel (GeglOperation *operation,
+               const gchar   *handler,
+               const gchar   *path,
+               const gchar   *resolved_path,
+               gint64         mtime,
+               goffset        size)
+{
+#ifdef HAVE_TIFF
+  GeglOp         *self = GEGL_OP (operation);
+  GeglProperties *o    = GEGL_PROPERTIES (operation);
+  GeglOperation  *source;
+  GeglBuffer     *buffer;
+
+  /* Metadata is only read by the handler */
+  if (o->metadata || strcmp (handler, "gegl:tiff-load"))
+    return FALSE;
+
+  buffer = resolved_path ? resolve_cache_buffer (resolved_path, mtime, size) : NULL;
+  if (buffer)
+    {
+      gegl_node_set (self->load,
+                     "operation", "gegl:buffer-source",
+                     "buffer", buffer,
+                     NULL);
+      g_object_unref (buffer);
+      return TRUE;
+    }
+
+  source = port_tiff_source_new (path, resolved_path, mtime, size);
+  if (!source)
+    return FALSE;
+
+  gegl_node_set (self->load, "gegl-operation", source, NULL);
+  g_object_unref (source);
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
 static gboolean
 read_from_stream (GInputStream *stream,
                   guchar      **buffer,
@@ -85,6 +676,9 @@ do_setup (GeglOperation *operation, const gchar *path, const gchar *uri)
   GeglProperties *o = GEGL_PROPERTIES (operation);
   const gchar *handler = NULL;
   gchar *content_type = NULL, *filename = NULL, *message;
+  gchar *cache_path = NULL;
+  gint64 cache_mtime = 0;
+  goffset cache_size = 0;
   gboolean load_from_uri, uncertain;
   GInputStream *stream = NULL;
   GError *error = NULL;
@@ -127,6 +721,36 @@ do_setup (GeglOperation *operation, const gchar *path, const gchar *uri)
       gchar *resolved_path = realpath (path, NULL);
       if (resolved_path)
         {
+          if (resolve_cache_stat (resolved_path, &cache_mtime, &cache_size))
+            {
+              gchar *cached_handler = resolve_cache_lookup (resolved_path,
+                                                            cache_mtime,
+                                                            cache_size);
+              if (cached_handler &&
+                  load_parallel (operation, cached_handler, path,
+                                 resolved_path, cache_mtime, cache_size))
+                {
+                  g_free (cached_handler);
+                  free (resolved_path);
+                  return;
+                }
+              if (cached_handler)
+                {
+                  gegl_node_set (self->load, "operation", cached_handler, NULL);
+
+                  if (o->metadata &&
+                      gegl_operation_find_property (cached_handler, "metadata") != NULL)
+                    gegl_node_set (self->load, "metadata", o->metadata, NULL);
+
+                  gegl_node_set (self->load, "path", path, NULL);
+
+                  g_free (cached_handler);
+                  free (resolved_path);
+                  return;
+                }
+              cache_path = g_strdup (resolved_path);
+            }
+
           filename = g_filename_display_name (resolved_path);
 
           stream = gegl_gio_open_input_stream (NULL, resolved_path, &file, &error);
@@ -258,6 +882,13 @@ do_setup (GeglOperation *operation, const gchar *path, const gchar *uri)
       goto cleanup;
     }
 
+  if (cache_path)
+    resolve_cache_insert (cache_path, cache_mtime, cache_size, handler);
+
+  if (!load_from_uri &&
+      load_parallel (operation, handler, path, cache_path, cache_mtime, cache_size))
+    goto cleanup;
+
   gegl_node_set (self->load, "operation", handler, NULL);
 
   if (o->metadata &&
@@ -283,6 +914,7 @@ cleanup:
 
   g_free (content_type);
   g_free (filename);
+  g_free (cache_path);
 }
 
 static void
@@ -376,4 +1008,18 @@ gegl_op_class_init (GeglOpClass *klass)
 
 }
 
+/* Called by module.c next to gegl_op_loadport_register_type, in this
+ * folderꞌs module and in rock-text-bundle. Without libtiff there is nothing
+ * to register.
+ */
+void gegl_op_port_tiff_source_register_type (GTypeModule *module);
+
+void
+gegl_op_port_tiff_source_register_type (GTypeModule *module)
+{
+#ifdef HAVE_TIFF
+  port_tiff_source_register_type (module);
+#endif
+}
+
 #endif
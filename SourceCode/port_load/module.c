@@ -0,0 +1,49 @@
+/* This file is an image processing operation for GEGL
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ */
+
+/*
+Module entry points of port:load. loadport.c is compiled with GEGL_OP_BUNDLE, so that the op port:load
+loads large TIFF files with is registered here next to port:load itself, see ../rock_text_bundle/module.c.
+ */
+
+#include "config.h"
+#include <glib-object.h>
+#include <gegl-plugin.h>
+
+void gegl_op_loadport_register_type         (GTypeModule *module);
+void gegl_op_port_tiff_source_register_type (GTypeModule *module);
+
+static const GeglModuleInfo modinfo =
+{
+  GEGL_MODULE_ABI_VERSION
+};
+
+G_MODULE_EXPORT const GeglModuleInfo *
+gegl_module_query (GTypeModule *module)
+{
+  return &modinfo;
+}
+
+G_MODULE_EXPORT gboolean
+gegl_module_register (GTypeModule *module)
+{
+  gegl_op_loadport_register_type (module);
+  gegl_op_port_tiff_source_register_type (module);
+
+  return TRUE;
+}
@@ -0,0 +1,104 @@
+/* This file is part of the GEGL Rock Text operations
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Per thread scratch memory for the rock text helper ops. Every render thread keeps one block that only
+grows, so after the first few tiles process() no longer calls malloc or free. A process() call asks for
+its total size once with rock_arena_begin and then carves its buffers out of it with rock_arena_alloc.
+Each op includes it directly, everything in here is static.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/* Every buffer starts on its own cache line */
+#define ROCK_ARENA_ALIGN 64
+#define ROCK_ARENA_SIZE(bytes) \
+  (((gsize) (bytes) + ROCK_ARENA_ALIGN - 1) & ~((gsize) ROCK_ARENA_ALIGN - 1))
+
+/* Blocks larger than this (whole image ops) are given back after use */
+#define ROCK_ARENA_MAX_KEEP (32 << 20)
+
+typedef struct
+{
+  guchar *data;
+  gsize   size;
+  gsize   used;
+} RockArena;
+
+static void
+rock_arena_free (gpointer data)
+{
+  RockArena *arena = data;
+
+  g_free (arena->data);
+  g_free (arena);
+}
+
+static GPrivate rock_arena_key = G_PRIVATE_INIT (rock_arena_free);
+
+/* Returns this threadꞌs arena with room for total bytes, total being the
+ * sum of ROCK_ARENA_SIZE() of every buffer that will be allocated.
+ */
+static RockArena *
+rock_arena_begin (gsize total)
+{
+  RockArena *arena = g_private_get (&rock_arena_key);
+
+  if (!arena)
+    {
+      arena = g_new0 (RockArena, 1);
+      g_private_set (&rock_arena_key, arena);
+    }
+
+  if (arena->size < total + ROCK_ARENA_ALIGN)
+    {
+      g_free (arena->data);
+      arena->size = total + ROCK_ARENA_ALIGN;
+      arena->data = g_malloc (arena->size);
+    }
+
+  arena->used = ROCK_ARENA_ALIGN - ((gsize) arena->data & (ROCK_ARENA_ALIGN - 1));
+  arena->used &= ROCK_ARENA_ALIGN - 1;
+
+  return arena;
+}
+
+static gpointer
+rock_arena_alloc (RockArena *arena,
+                  gsize      bytes)
+{
+  gpointer block = arena->data + arena->used;
+
+  arena->used += ROCK_ARENA_SIZE (bytes);
+  g_assert (arena->used <= arena->size);
+
+  return block;
+}
+
+static void
+rock_arena_end (RockArena *arena)
+{
+  if (arena->size > ROCK_ARENA_MAX_KEEP)
+    {
+      g_clear_pointer (&arena->data, g_free);
+      arena->size = 0;
+    }
+}
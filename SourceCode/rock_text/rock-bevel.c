@@ -0,0 +1,282 @@
+/* This file is an image processing operation for GEGL
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Internal part of Rock Text. An alternative to emboss for the rock relief. The height of every pixel
+comes from its distance to the edge of the rock shape, the distance is computed in linear time, so a
+wide bevel costs the same as a narrow one. The output is a grey shade with the input alpha, like
+gegl:emboss, so rock text blends it the same way.
+ */
+
+#include "config.h"
+#include <glib/gi18n-lib.h>
+
+#ifdef GEGL_PROPERTIES
+
+enum_start (rock_bevel_profile)
+  enum_value (ROCK_BEVEL_LINEAR, "linear", N_("Linear"))
+  enum_value (ROCK_BEVEL_ROUND,  "round",  N_("Round"))
+  enum_value (ROCK_BEVEL_SMOOTH, "smooth", N_("Smooth"))
+enum_end (RockBevelProfile)
+
+property_enum (profile, _("Profile"),
+    RockBevelProfile, rock_bevel_profile,
+    ROCK_BEVEL_ROUND)
+  description (_("Shape of the bevel from the edge inwards"))
+
+property_double (width, _("Bevel width"), 8.0)
+  description (_("Distance from the edge at which the bevel reaches its full height"))
+  value_range (1.0, 200.0)
+  ui_range    (1.0, 60.0)
+  ui_meta     ("unit", "pixel-distance")
+
+property_double (azimuth, _("Azimuth"), 180.0)
+  description (_("Light angle (degrees)"))
+  value_range (0, 360)
+  ui_meta ("unit", "degree")
+  ui_meta ("direction", "ccw")
+
+property_double (elevation, _("Elevation"), 80.0)
+  description (_("Elevation angle (degrees)"))
+  value_range (0, 180)
+  ui_meta ("unit", "degree")
+
+property_int (depth, _("Depth"), 20)
+  description (_("Height of the bevel, 20 makes it as high as it is wide"))
+  value_range (1, 100)
+
+#else
+
+#define GEGL_OP_FILTER
+#define GEGL_OP_NAME     rock_bevel
+#define GEGL_OP_C_SOURCE rock-bevel.c
+
+#include "gegl-op.h"
+#include "rock-edt.h"
+#include "rock-format.h"
+
+/* Only alpha is read, so the input is taken in whatever linear float RGBA
+ * comes in. The grey shade is written straight, like gegl:emboss.
+ */
+static void
+prepare (GeglOperation *operation)
+{
+  const Babl *space = gegl_operation_get_source_space (operation, "input");
+
+  gegl_operation_set_format (operation, "input",
+                             rock_format_negotiate (operation, "input", "RGBA float", NULL));
+  gegl_operation_set_format (operation, "output",
+                             babl_format_with_space ("RGBA float", space));
+}
+
+static GeglRectangle
+get_bounding_box (GeglOperation *operation)
+{
+  GeglRectangle *in_rect = gegl_operation_source_get_bounding_box (operation, "input");
+
+  if (in_rect)
+    return *in_rect;
+
+  return *GEGL_RECTANGLE (0, 0, 0, 0);
+}
+
+/* Past o->width from the edge the height is flat, so a pixel only depends
+ * on the pixels within that distance, one more for rounding and one for the
+ * slope.
+ */
+static gint
+bevel_reach (GeglProperties *o)
+{
+  return (gint) ceil (o->width) + 2;
+}
+
+static GeglRectangle
+get_required_for_output (GeglOperation       *operation,
+                         const gchar         *input_pad,
+                         const GeglRectangle *roi)
+{
+  GeglProperties *o      = GEGL_PROPERTIES (operation);
+  GeglRectangle   extent = get_bounding_box (operation);
+  GeglRectangle   rect   = *roi;
+  gint            reach  = bevel_reach (o);
+
+  rect.x      -= reach;
+  rect.y      -= reach;
+  rect.width  += 2 * reach;
+  rect.height += 2 * reach;
+
+  /* Keep one transparent pixel around the input, or opaque pixels on the
+   * edge of its bounding box would have no outside to fall off towards
+   */
+  if (!gegl_rectangle_is_infinite_plane (&extent))
+    {
+      extent.x      -= 1;
+      extent.y      -= 1;
+      extent.width  += 2;
+      extent.height += 2;
+    }
+
+  gegl_rectangle_intersect (&rect, &rect, &extent);
+  return rect;
+}
+
+static GeglRectangle
+get_invalidated_by_change (GeglOperation       *operation,
+                           const gchar         *input_pad,
+                           const GeglRectangle *input_region)
+{
+  GeglProperties *o     = GEGL_PROPERTIES (operation);
+  GeglRectangle   rect  = *input_region;
+  gint            reach = bevel_reach (o);
+
+  rect.x      -= reach;
+  rect.y      -= reach;
+  rect.width  += 2 * reach;
+  rect.height += 2 * reach;
+
+  return rect;
+}
+
+static gfloat
+bevel_profile (RockBevelProfile profile,
+               gfloat           t)
+{
+  switch (profile)
+    {
+    case ROCK_BEVEL_LINEAR:
+      return t;
+    case ROCK_BEVEL_ROUND:
+      return sqrtf (1.0f - (1.0f - t) * (1.0f - t));
+    case ROCK_BEVEL_SMOOTH:
+      return t * t * (3.0f - 2.0f * t);
+    }
+  return t;
+}
+
+static gboolean
+process (GeglOperation       *operation,
+         GeglBuffer          *input,
+         GeglBuffer          *output,
+         const GeglRectangle *result,
+         gint                 level)
+{
+  GeglProperties *o      = GEGL_PROPERTIES (operation);
+  const Babl     *format = gegl_operation_get_format (operation, "output");
+  GeglRectangle   extent = get_required_for_output (operation, "input", result);
+  gint            width  = extent.width;
+  gint            height = extent.height;
+  gint            n      = width * height;
+  RockArena      *arena;
+  gfloat         *pixels, *height_map, *out;
+  gfloat          scale;
+  gdouble         azimuth, elevation, lx, ly, lz;
+  gint            x, y, i;
+
+  if (n <= 0 || result->width <= 0 || result->height <= 0)
+    return TRUE;
+
+  arena      = rock_arena_begin (ROCK_ARENA_SIZE (sizeof (gfloat) * n * 4) +
+                                 ROCK_ARENA_SIZE (sizeof (gfloat) * n) +
+                                 rock_edt_scratch_size (width, height));
+  pixels     = rock_arena_alloc (arena, sizeof (gfloat) * n * 4);
+  height_map = rock_arena_alloc (arena, sizeof (gfloat) * n);
+
+  /* rgb is overwritten below, so reading it premultiplied is fine */
+  gegl_buffer_get (input, &extent, 1.0,
+                   gegl_operation_get_format (operation, "input"), pixels,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  /* Distance of every inside pixel to the nearest outside pixel. Outside the
+   * window nothing closer than o->width can matter for the result.
+   */
+  for (i = 0; i < n; i++)
+    height_map[i] = pixels[i * 4 + 3] > 0.5f ? ROCK_EDT_INF : 0.0f;
+
+  rock_edt_2d (height_map, width, height, arena);
+
+  scale = o->width * o->depth / 20.0f;
+  for (i = 0; i < n; i++)
+    {
+      gfloat t = CLAMP ((height_map[i] - 0.5f) / o->width, 0.0f, 1.0f);
+
+      height_map[i] = bevel_profile (o->profile, t) * scale;
+    }
+
+  azimuth   = G_PI * o->azimuth / 180.0;
+  elevation = G_PI * o->elevation / 180.0;
+  lx = cos (azimuth) * cos (elevation);
+  ly = sin (azimuth) * cos (elevation);
+  lz = sin (elevation);
+
+  for (y = result->y - extent.y; y < result->y - extent.y + result->height; y++)
+    for (x = result->x - extent.x; x < result->x - extent.x + result->width; x++)
+      {
+        gint    xl = MAX (x - 1, 0), xr = MIN (x + 1, width - 1);
+        gint    yt = MAX (y - 1, 0), yb = MIN (y + 1, height - 1);
+        gdouble nx = -(height_map[y * width + xr] - height_map[y * width + xl]) / MAX (xr - xl, 1);
+        gdouble ny = -(height_map[yb * width + x] - height_map[yt * width + x]) / MAX (yb - yt, 1);
+        gdouble ndotl = nx * lx + ny * ly + lz;
+        gfloat  shade = ndotl > 0.0 ? ndotl / sqrt (nx * nx + ny * ny + 1.0) : 0.0;
+        gfloat *pixel = pixels + (y * width + x) * 4;
+
+        pixel[0] = pixel[1] = pixel[2] = shade;
+      }
+
+  /* Pack the rows of result together at the start of pixels */
+  out = pixels;
+  for (y = 0; y < result->height; y++)
+    {
+      memmove (out + y * result->width * 4,
+               pixels + ((result->y - extent.y + y) * width + result->x - extent.x) * 4,
+               sizeof (gfloat) * result->width * 4);
+    }
+
+  gegl_buffer_set (output, result, 0, format, out, GEGL_AUTO_ROWSTRIDE);
+
+  rock_arena_end (arena);
+
+  return TRUE;
+}
+
+static void
+gegl_op_class_init (GeglOpClass *klass)
+{
+  GeglOperationClass       *operation_class;
+  GeglOperationFilterClass *filter_class;
+
+  operation_class = GEGL_OPERATION_CLASS (klass);
+  filter_class    = GEGL_OPERATION_FILTER_CLASS (klass);
+
+  operation_class->prepare                   = prepare;
+  operation_class->get_bounding_box          = get_bounding_box;
+  operation_class->get_required_for_output   = get_required_for_output;
+  operation_class->get_invalidated_by_change = get_invalidated_by_change;
+  operation_class->threaded                  = TRUE;
+  filter_class->process                      = process;
+
+  gegl_operation_class_set_keys (operation_class,
+    "name",        "lb:rock-bevel",
+    "title",       _("Rock Text distance bevel"),
+    "categories",  "hidden",
+    "reference-hash", "c47d19e02b6af831d5e9b2ac",
+    "description", _("Bevel shading from a distance transform of the alpha. Used inside Rock Text"),
+    NULL);
+}
+
+#endif
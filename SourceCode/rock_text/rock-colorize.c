@@ -0,0 +1,145 @@
+/* This file is an image processing operation for GEGL
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Internal part of Rock Text. It does in one pass what these nodes of rock text did one after another
+
+gimp:threshold-alpha
+multiply aux=[ port:load src=overlay.png ]
+id=1 multiply aux=[ ref=1 color-overlay value=#9a7143 ]
+
+Rock text uses it between the emboss blend and the outline. Multiplying by the color is moved in front
+of the outline, so rock text tints the outline color with the same color to keep the result unchanged.
+ */
+
+#include "config.h"
+#include <glib/gi18n-lib.h>
+
+#ifdef GEGL_PROPERTIES
+
+property_double (value, _("Alpha threshold"), 0.5)
+    description (_("Alpha above this value becomes fully opaque, the rest fully transparent"))
+    value_range (0.0, 1.0)
+
+property_color  (color, _("Color"), "#9a7143")
+    description (_("Color the rock is multiplied with"))
+
+#else
+
+#define GEGL_OP_POINT_COMPOSER
+#define GEGL_OP_NAME     rock_colorize
+#define GEGL_OP_C_SOURCE rock-colorize.c
+
+#include "gegl-op.h"
+#include "rock-dispatch.h"
+
+static void
+prepare (GeglOperation *operation)
+{
+  const Babl *space  = gegl_operation_get_source_space (operation, "input");
+  const Babl *format = babl_format_with_space ("RGBA float", space);
+
+  gegl_operation_set_format (operation, "input",  format);
+  gegl_operation_set_format (operation, "aux",    format);
+  gegl_operation_set_format (operation, "output", format);
+}
+
+/* aux may be NULL, then only the color is multiplied in. Same order of
+ * multiplications as the separate nodes, so the floats match.
+ */
+ROCK_KERNEL static void
+colorize_pixels (const gfloat *in,
+                 const gfloat *aux,
+                 gfloat       *out,
+                 const gfloat *color,
+                 gfloat        threshold,
+                 glong         n_pixels)
+{
+  glong i;
+
+  if (aux)
+    {
+      for (i = 0; i < n_pixels; i++)
+        {
+          out[0] = (in[0] * aux[0]) * color[0];
+          out[1] = (in[1] * aux[1]) * color[1];
+          out[2] = (in[2] * aux[2]) * color[2];
+          out[3] = in[3] > threshold ? 1.0f : 0.0f;
+
+          in  += 4;
+          aux += 4;
+          out += 4;
+        }
+    }
+  else
+    {
+      for (i = 0; i < n_pixels; i++)
+        {
+          out[0] = in[0] * color[0];
+          out[1] = in[1] * color[1];
+          out[2] = in[2] * color[2];
+          out[3] = in[3] > threshold ? 1.0f : 0.0f;
+
+          in  += 4;
+          out += 4;
+        }
+    }
+}
+
+static gboolean
+process (GeglOperation       *operation,
+         void                *in_buf,
+         void                *aux_buf,
+         void                *out_buf,
+         glong                n_pixels,
+         const GeglRectangle *roi,
+         gint                 level)
+{
+  GeglProperties *o = GEGL_PROPERTIES (operation);
+  gfloat          color[4];
+
+  gegl_color_get_pixel (o->color, gegl_operation_get_format (operation, "output"), color);
+
+  colorize_pixels (in_buf, aux_buf, out_buf, color, o->value, n_pixels);
+
+  return TRUE;
+}
+
+static void
+gegl_op_class_init (GeglOpClass *klass)
+{
+  GeglOperationClass              *operation_class;
+  GeglOperationPointComposerClass *point_composer_class;
+
+  operation_class      = GEGL_OPERATION_CLASS (klass);
+  point_composer_class = GEGL_OPERATION_POINT_COMPOSER_CLASS (klass);
+
+  operation_class->prepare = prepare;
+  point_composer_class->process = process;
+
+  gegl_operation_class_set_keys (operation_class,
+    "name",        "lb:rock-colorize",
+    "title",       _("Rock Text colorize"),
+    "categories",  "hidden",
+    "reference-hash", "3f1a6d09c2bb84e71c5ab2ac",
+    "description", _("Threshold alpha, multiply with an overlay and with a color in one pass. Used inside Rock Text"),
+    NULL);
+}
+
+#endif
@@ -0,0 +1,37 @@
+/* This file is part of the GEGL Rock Text operations
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Runtime CPU dispatch for the inner loops of the rock text helper ops. A function marked ROCK_KERNEL is
+compiled three times, for baseline x86-64 (which includes SSE2), for AVX2 and for AVX-512, and the
+dynamic loader picks the best one for the CPU once, when the module is loaded. Everywhere else, and
+with compilers that lack target_clones, ROCK_KERNEL is empty and the function is built once as usual.
+ */
+
+#pragma once
+
+#if defined (__has_attribute)
+#  if __has_attribute (target_clones) && (defined (__x86_64__) || defined (__i386__)) && defined (__linux__) && !defined (ROCK_NO_DISPATCH)
+#    define ROCK_KERNEL __attribute__ ((target_clones ("default", "avx2", "avx512f")))
+#  endif
+#endif
+
+#ifndef ROCK_KERNEL
+#  define ROCK_KERNEL
+#endif
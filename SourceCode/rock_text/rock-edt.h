@@ -0,0 +1,131 @@
+/* This file is part of the GEGL Rock Text operations
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Exact euclidean distance transform in linear time (Felzenszwalb and Huttenlocher), shared by the rock
+text helper ops. Each op includes it directly, everything in here is static.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+#include "rock-arena.h"
+#include "rock-dispatch.h"
+
+#define ROCK_EDT_INF 1e20f
+
+/* Squared distance transform of one line of n samples. f holds 0 on
+ * feature samples and ROCK_EDT_INF elsewhere. v and z are scratch space of
+ * n and n + 1 entries. The squares are taken in float, q * q overflows a
+ * gint on lines longer than 46340 samples.
+ */
+ROCK_KERNEL static void
+rock_edt_1d (const gfloat *f,
+             gfloat       *d,
+             gint         *v,
+             gfloat       *z,
+             gint          n)
+{
+  gint k = 0;
+  gint q;
+
+#define SQUARE(i) ((gfloat) (i) * (gfloat) (i))
+
+  v[0] = 0;
+  z[0] = -ROCK_EDT_INF;
+  z[1] =  ROCK_EDT_INF;
+
+  for (q = 1; q < n; q++)
+    {
+      gfloat s = ((f[q] + SQUARE (q)) - (f[v[k]] + SQUARE (v[k]))) / (2.0f * (q - v[k]));
+
+      /* z[0] is -inf, so this always stops at k == 0 */
+      while (s <= z[k])
+        {
+          k--;
+          s = ((f[q] + SQUARE (q)) - (f[v[k]] + SQUARE (v[k]))) / (2.0f * (q - v[k]));
+        }
+
+      k++;
+      v[k]     = q;
+      z[k]     = s;
+      z[k + 1] = ROCK_EDT_INF;
+    }
+
+  k = 0;
+  for (q = 0; q < n; q++)
+    {
+      while (z[k + 1] < q)
+        k++;
+      d[q] = SQUARE (q - v[k]) + f[v[k]];
+    }
+
+#undef SQUARE
+}
+
+/* Arena space rock_edt_2d needs for a width x height grid */
+static gsize
+rock_edt_scratch_size (gint width,
+                       gint height)
+{
+  gint n = MAX (width, height);
+
+  return 2 * ROCK_ARENA_SIZE (sizeof (gfloat) * n) +
+         ROCK_ARENA_SIZE (sizeof (gfloat) * (n + 1)) +
+         ROCK_ARENA_SIZE (sizeof (gint) * n);
+}
+
+/* Replaces grid, width x height values of 0 (feature) or ROCK_EDT_INF, with
+ * the euclidean distance of every sample to the nearest feature.
+ */
+static void
+rock_edt_2d (gfloat    *grid,
+             gint       width,
+             gint       height,
+             RockArena *arena)
+{
+  gint    n    = MAX (width, height);
+  gfloat *f    = rock_arena_alloc (arena, sizeof (gfloat) * n);
+  gfloat *d    = rock_arena_alloc (arena, sizeof (gfloat) * n);
+  gfloat *z    = rock_arena_alloc (arena, sizeof (gfloat) * (n + 1));
+  gint   *v    = rock_arena_alloc (arena, sizeof (gint) * n);
+  gint    x, y;
+
+  for (x = 0; x < width; x++)
+    {
+      for (y = 0; y < height; y++)
+        f[y] = grid[y * width + x];
+      rock_edt_1d (f, d, v, z, height);
+      for (y = 0; y < height; y++)
+        grid[y * width + x] = d[y];
+    }
+
+  for (y = 0; y < height; y++)
+    {
+      gfloat *row = grid + y * width;
+
+      memcpy (f, row, sizeof (gfloat) * width);
+      rock_edt_1d (f, row, v, z, width);
+    }
+
+  for (x = 0; x < width * height; x++)
+    grid[x] = sqrtf (grid[x]);
+}
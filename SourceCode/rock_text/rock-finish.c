@@ -0,0 +1,590 @@
+/* This file is an image processing operation for GEGL
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Internal part of Rock Text. It does in one pass what these nodes of rock text did one after another
+
+over aux=[ grain ]
+mean-curvature-blur iterations=1
+exposure exposure=0.5
+lb:edgesmooth (with edgesmooth=true)
+
+Every tile is fetched once with the one pixel halo mean curvature blur needs, instead of each node
+fetching and converting its own padded input. The scratch rows come from a per thread arena.
+
+With edgesmooth the padded tile also goes through what lb:edgesmooth does with abyss none: the result
+over its xor with a median, then dst-atop a second median of the blurred and strengthened first median,
+and 8 bit output like its final radius 0 median. Its two first medians are the same, so they are computed
+once. The medians are the 8 bit histograms of lb:rock-median and the blur is always the FIR gaussian, so
+rock text only uses it below final quality; rock-text-batch --finish-check compares it with lb:edgesmooth.
+ */
+
+#include "config.h"
+#include <glib/gi18n-lib.h>
+
+#ifdef GEGL_PROPERTIES
+
+property_double (exposure, _("Exposure"), 0.5)
+    description (_("Relative brightening strength"))
+    ui_range    (-2.0, 2.0)
+
+property_boolean (edgesmooth, _("Smooth edges"), FALSE)
+    description (_("Smooth the edges after the exposure like lb:edgesmooth does"))
+
+property_double  (alpha_percentile2, _("Median edge"), 73.0)
+    description (_("Alpha percentile of the median on the edges"))
+    value_range (0, 100)
+
+property_double (gaus, _("Blur edge"), 1.0)
+    description (_("Gaussian blur on the edges"))
+    value_range (0.0, 3.0)
+    ui_meta     ("unit", "pixel-distance")
+
+property_double (value, _("Increase opacity"), 1.2)
+    description (_("Increase the opacity around the edges"))
+    value_range (1.0, 6.0)
+
+#else
+
+#define GEGL_OP_COMPOSER
+#define GEGL_OP_NAME     rock_finish
+#define GEGL_OP_C_SOURCE rock-finish.c
+
+#include "gegl-op.h"
+#include "rock-arena.h"
+#include "rock-histogram.h"
+#include "rock-dispatch.h"
+
+#define HALO 1
+
+/* The radius of every median of lb:edgesmooth */
+#define SMOOTH_RADIUS 2
+
+/* Same kernel length as the FIR gegl:gaussian-blur uses */
+static gint
+smooth_blur_radius (GeglProperties *o)
+{
+  return o->gaus > 0.0001 ? 3 * (gint) ceil (o->gaus) : 0;
+}
+
+/* How far the edge smoothing reads around a pixel: the second median of
+ * the blur of the first one
+ */
+static gint
+smooth_reach (GeglProperties *o)
+{
+  return o->edgesmooth ? 2 * SMOOTH_RADIUS + smooth_blur_radius (o) : 0;
+}
+
+static GeglRectangle
+grow_rect (const GeglRectangle *rect,
+           gint                 amount)
+{
+  GeglRectangle grown = *rect;
+
+  grown.x      -= amount;
+  grown.y      -= amount;
+  grown.width  += 2 * amount;
+  grown.height += 2 * amount;
+
+  return grown;
+}
+
+static void
+prepare (GeglOperation *operation)
+{
+  GeglProperties *o     = GEGL_PROPERTIES (operation);
+  const Babl     *space = gegl_operation_get_source_space (operation, "input");
+
+  gegl_operation_set_format (operation, "input",
+                             babl_format_with_space ("RaGaBaA float", space));
+  gegl_operation_set_format (operation, "aux",
+                             babl_format_with_space ("RaGaBaA float", space));
+  /* lb:edgesmooth ends in a median, which writes 8 bits */
+  gegl_operation_set_format (operation, "output",
+                             babl_format_with_space (o->edgesmooth ? "R'G'B'A u8" : "RGBA float",
+                                                     space));
+}
+
+/* Where the grain over has pixels, like gegl:over */
+static GeglRectangle
+finish_box (GeglOperation *operation)
+{
+  GeglRectangle *in_rect  = gegl_operation_source_get_bounding_box (operation, "input");
+  GeglRectangle *aux_rect = gegl_operation_source_get_bounding_box (operation, "aux");
+  GeglRectangle  rect     = { 0, 0, 0, 0 };
+
+  if (in_rect)
+    rect = *in_rect;
+  if (aux_rect)
+    gegl_rectangle_bounding_box (&rect, &rect, aux_rect);
+
+  return rect;
+}
+
+static GeglRectangle
+get_bounding_box (GeglOperation *operation)
+{
+  GeglRectangle rect = finish_box (operation);
+
+  /* The medians and blur of the edge smoothing grow past it */
+  if (gegl_rectangle_is_infinite_plane (&rect) || gegl_rectangle_is_empty (&rect))
+    return rect;
+
+  return grow_rect (&rect, smooth_reach (GEGL_PROPERTIES (operation)));
+}
+
+static GeglRectangle
+get_required_for_output (GeglOperation       *operation,
+                         const gchar         *input_pad,
+                         const GeglRectangle *roi)
+{
+  return grow_rect (roi, HALO + smooth_reach (GEGL_PROPERTIES (operation)));
+}
+
+static GeglRectangle
+get_invalidated_by_change (GeglOperation       *operation,
+                           const gchar         *input_pad,
+                           const GeglRectangle *input_region)
+{
+  return get_required_for_output (operation, input_pad, input_region);
+}
+
+/* One iteration of gegl:mean-curvature-blur on one row of R'G'B'A float.
+ * top, mid and bottom are the rows above, at and below it, each with a one
+ * pixel border left and right of the width pixels written to out.
+ */
+ROCK_KERNEL static void
+mean_curvature_row (const gfloat *top,
+                    const gfloat *mid,
+                    const gfloat *bottom,
+                    gfloat       *out,
+                    gint          width)
+{
+  gint x, c;
+
+#define TOP_LEFT(c)     (top[p - 4 + (c)])
+#define TOP(c)          (top[p + (c)])
+#define TOP_RIGHT(c)    (top[p + 4 + (c)])
+#define LEFT(c)         (mid[p - 4 + (c)])
+#define RIGHT(c)        (mid[p + 4 + (c)])
+#define BOTTOM_LEFT(c)  (bottom[p - 4 + (c)])
+#define BOTTOM(c)       (bottom[p + (c)])
+#define BOTTOM_RIGHT(c) (bottom[p + 4 + (c)])
+#define CENTER(c)       (mid[p + (c)])
+
+  for (x = 0; x < width; x++)
+    {
+      gint p = (x + 1) * 4;
+
+      for (c = 0; c < 3; c++)
+        {
+          gdouble dx        = RIGHT (c) - LEFT (c);
+          gdouble dy        = BOTTOM (c) - TOP (c);
+          gdouble magnitude = sqrt (dx * dx + dy * dy);
+
+          out[c] = CENTER (c);
+
+          if (magnitude)
+            {
+              gdouble dx2 = dx * dx;
+              gdouble dy2 = dy * dy;
+              gdouble dxx = RIGHT (c) + LEFT (c) - 2. * CENTER (c);
+              gdouble dyy = BOTTOM (c) + TOP (c) - 2. * CENTER (c);
+              gdouble dxy = 0.25 * (BOTTOM_RIGHT (c) - TOP_RIGHT (c) -
+                                    BOTTOM_LEFT (c) + TOP_LEFT (c));
+              gdouble n   = dx2 * dyy + dy2 * dxx - 2. * dx * dy * dxy;
+              gdouble d   = sqrt (pow (dx2 + dy2, 3.));
+              gdouble mean_curvature = n / d;
+
+              out[c] += (0.25 * magnitude * mean_curvature);
+            }
+        }
+      out[3] = CENTER (3);
+
+      out += 4;
+    }
+
+#undef TOP_LEFT
+#undef TOP
+#undef TOP_RIGHT
+#undef LEFT
+#undef RIGHT
+#undef BOTTOM_LEFT
+#undef BOTTOM
+#undef BOTTOM_RIGHT
+#undef CENTER
+}
+
+/* Fetches row of the padded tile into dst: the input with the grain over
+ * it, converted to the perceptual values mean curvature blur works on.
+ */
+static void
+load_row (GeglBuffer          *input,
+          GeglBuffer          *aux,
+          const GeglRectangle *halo,
+          gint                 row,
+          const Babl          *premul,
+          const Babl          *to_perceptual,
+          gfloat              *dst,
+          gfloat              *aux_row)
+{
+  GeglRectangle rect = { halo->x, halo->y + row, halo->width, 1 };
+  gint          i;
+
+  gegl_buffer_get (input, &rect, 1.0, premul, dst,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_CLAMP);
+
+  /* gegl:over, the grain on top */
+  if (aux)
+    {
+      gegl_buffer_get (aux, &rect, 1.0, premul, aux_row,
+                       GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_CLAMP);
+
+      for (i = 0; i < halo->width; i++)
+        {
+          gfloat       *in  = dst + i * 4;
+          const gfloat *top = aux_row + i * 4;
+          gfloat        inv = 1.0f - top[3];
+
+          in[0] = top[0] + in[0] * inv;
+          in[1] = top[1] + in[1] * inv;
+          in[2] = top[2] + in[2] * inv;
+          in[3] = top[3] + in[3] * inv;
+        }
+    }
+
+  /* gegl:mean-curvature-blur works on non premultiplied perceptual values */
+  babl_process (to_perceptual, dst, dst, halo->width);
+}
+
+/* Grain over, mean curvature blur and exposure of rect into out, in linear
+ * RGBA float. The padded rect goes through a ring of three rows, the only
+ * rows the 3x3 mean curvature kernel needs, so the working set stays a few
+ * rows wide instead of the whole padded rect.
+ */
+static void
+finish_rect (GeglOperation       *operation,
+             GeglBuffer          *input,
+             GeglBuffer          *aux,
+             const GeglRectangle *rect,
+             gfloat              *ring[3],
+             gfloat              *aux_row,
+             gfloat              *out_buf)
+{
+  GeglProperties *o          = GEGL_PROPERTIES (operation);
+  const Babl     *premul     = gegl_operation_get_format (operation, "input");
+  const Babl     *space      = babl_format_get_space (premul);
+  const Babl     *linear     = babl_format_with_space ("RGBA float", space);
+  const Babl     *perceptual = babl_format_with_space ("R'G'B'A float", space);
+  const Babl     *to_perceptual = babl_fish (premul, perceptual);
+  GeglRectangle   halo       = grow_rect (rect, HALO);
+  gint            n_out      = rect->width * rect->height;
+  gfloat          white, diff, gain;
+  gint            i, y;
+
+  load_row (input, aux, &halo, 0, premul, to_perceptual, ring[0], aux_row);
+  load_row (input, aux, &halo, 1, premul, to_perceptual, ring[1], aux_row);
+
+  for (y = 0; y < rect->height; y++)
+    {
+      load_row (input, aux, &halo, y + 2, premul, to_perceptual, ring[(y + 2) % 3], aux_row);
+      mean_curvature_row (ring[y % 3], ring[(y + 1) % 3], ring[(y + 2) % 3],
+                          out_buf + y * rect->width * 4, rect->width);
+    }
+
+  /* gegl:exposure with a black level of 0 */
+  babl_process (babl_fish (perceptual, linear), out_buf, out_buf, n_out);
+
+  white = exp2f (-o->exposure);
+  diff  = MAX (white, 0.000001f);
+  gain  = 1.0f / diff;
+
+  for (i = 0; i < n_out; i++)
+    {
+      gfloat *out = out_buf + i * 4;
+
+      out[0] = out[0] * gain;
+      out[1] = out[1] * gain;
+      out[2] = out[2] * gain;
+    }
+}
+
+/* One pass of the FIR gaussian over the four channels of width pixels,
+ * reading length pixels stride floats apart for each of them.
+ */
+ROCK_KERNEL static void
+blur_line (const gfloat *src,
+           gint          stride,
+           const gfloat *kernel,
+           gint          length,
+           gfloat       *out,
+           gint          out_stride,
+           gint          width)
+{
+  gint x, k, c;
+
+  for (x = 0; x < width; x++)
+    {
+      gfloat acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+      for (k = 0; k < length; k++)
+        for (c = 0; c < 4; c++)
+          acc[c] += src[x * out_stride + k * stride + c] * kernel[k];
+
+      for (c = 0; c < 4; c++)
+        out[x * out_stride + c] = acc[c];
+    }
+}
+
+typedef struct
+{
+  GeglRectangle f_rect;   /* the finished pixels the smoothing reads */
+  GeglRectangle a_rect;   /* the first median */
+  GeglRectangle c_rect;   /* its blur */
+  gint          blur_r;
+} SmoothRects;
+
+static void
+smooth_rects (GeglProperties      *o,
+              const GeglRectangle *result,
+              SmoothRects         *rects)
+{
+  rects->blur_r = smooth_blur_radius (o);
+  rects->c_rect = grow_rect (result, SMOOTH_RADIUS);
+  rects->a_rect = grow_rect (&rects->c_rect, rects->blur_r);
+  rects->f_rect = grow_rect (&rects->a_rect, SMOOTH_RADIUS);
+}
+
+static gsize
+smooth_scratch_size (const SmoothRects   *rects,
+                     const GeglRectangle *result)
+{
+  gsize f_n = (gsize) rects->f_rect.width * rects->f_rect.height;
+  gsize a_n = (gsize) rects->a_rect.width * rects->a_rect.height;
+  gsize c_n = (gsize) rects->c_rect.width * rects->c_rect.height;
+  gsize t_n = (gsize) rects->c_rect.width * rects->a_rect.height;
+  gsize n   = (gsize) result->width * result->height;
+
+  return ROCK_ARENA_SIZE (f_n * 4) +
+         ROCK_ARENA_SIZE (sizeof (gfloat) * a_n * 4) +
+         ROCK_ARENA_SIZE (sizeof (gfloat) * t_n * 4) +
+         ROCK_ARENA_SIZE (sizeof (gfloat) * c_n * 4) +
+         ROCK_ARENA_SIZE (c_n * 4) +
+         2 * ROCK_ARENA_SIZE (sizeof (gfloat) * n * 4) +
+         ROCK_ARENA_SIZE (sizeof (gfloat) * (2 * rects->blur_r + 1)) +
+         ROCK_ARENA_SIZE (sizeof (gint) * (2 * SMOOTH_RADIUS + 1)) +
+         ROCK_ARENA_SIZE (sizeof (RockHistogram));
+}
+
+/* lb:edgesmooth on the finished pixels f of rects->f_rect, which are
+ * transparent outside box, into out on result in RaGaBaA float.
+ */
+static void
+smooth_edges (GeglProperties      *o,
+              const Babl          *space,
+              const SmoothRects   *rects,
+              const GeglRectangle *box,
+              gfloat              *f,
+              const GeglRectangle *result,
+              RockArena           *arena,
+              gfloat              *out)
+{
+  const Babl    *linear  = babl_format_with_space ("RGBA float", space);
+  const Babl    *premul  = babl_format_with_space ("RaGaBaA float", space);
+  const Babl    *median  = babl_format_with_space ("R'G'B'A float", space);
+  const Babl    *bytes   = babl_format_with_space ("R'G'B'A u8", space);
+  gint           f_w     = rects->f_rect.width;
+  gint           a_w     = rects->a_rect.width;
+  gint           a_h     = rects->a_rect.height;
+  gint           c_w     = rects->c_rect.width;
+  gint           c_h     = rects->c_rect.height;
+  gint           w       = result->width;
+  gint           h       = result->height;
+  gint           blur_r  = rects->blur_r;
+  gint           length  = 2 * blur_r + 1;
+  gint           f_off   = 2 * SMOOTH_RADIUS + blur_r;
+  gint           a_off   = SMOOTH_RADIUS + blur_r;
+  guchar        *f_u8    = rock_arena_alloc (arena, (gsize) f_w * rects->f_rect.height * 4);
+  gfloat        *a       = rock_arena_alloc (arena, sizeof (gfloat) * a_w * a_h * 4);
+  gfloat        *tmp     = rock_arena_alloc (arena, sizeof (gfloat) * c_w * a_h * 4);
+  gfloat        *c       = rock_arena_alloc (arena, sizeof (gfloat) * c_w * c_h * 4);
+  guchar        *d_u8    = rock_arena_alloc (arena, (gsize) c_w * c_h * 4);
+  gfloat        *e       = rock_arena_alloc (arena, sizeof (gfloat) * w * h * 4);
+  gfloat        *kernel  = rock_arena_alloc (arena, sizeof (gfloat) * length);
+  gint          *half    = rock_arena_alloc (arena, sizeof (gint) * (2 * SMOOTH_RADIUS + 1));
+  RockHistogram *hist    = rock_arena_alloc (arena, sizeof (RockHistogram));
+  gfloat         sum     = 0.0f;
+  gint           x, y, i, k;
+
+  /* The finished pixels end at box, the medians read transparency past it */
+  for (y = 0; y < rects->f_rect.height; y++)
+    for (x = 0; x < f_w; x++)
+      if (!gegl_rectangle_contains (box, GEGL_RECTANGLE (rects->f_rect.x + x,
+                                                         rects->f_rect.y + y, 1, 1)))
+        memset (f + (y * f_w + x) * 4, 0, sizeof (gfloat) * 4);
+
+  babl_process (babl_fish (linear, bytes), f, f_u8, f_w * rects->f_rect.height);
+  rock_circle_rows (SMOOTH_RADIUS, half);
+
+  /* The median of the xor and the first median of the edge are the same */
+  for (y = 0; y < a_h; y++)
+    rock_median_row (f_u8 + y * f_w * 4, f_w, SMOOTH_RADIUS, half, 50.0, 2.0, hist,
+                     a + y * a_w * 4, a_w);
+  babl_process (babl_fish (median, premul), a, a, a_w * a_h);
+
+  /* gegl:gaussian-blur without clipping, then gegl:opacity */
+  for (k = 0; k < length; k++)
+    {
+      gfloat d = k - blur_r;
+
+      kernel[k] = blur_r ? expf (-(d * d) / (2.0f * o->gaus * o->gaus)) : 1.0f;
+      sum += kernel[k];
+    }
+  for (k = 0; k < length; k++)
+    kernel[k] /= sum;
+
+  for (y = 0; y < a_h; y++)
+    blur_line (a + y * a_w * 4, 4, kernel, length, tmp + y * c_w * 4, 4, c_w);
+  for (y = 0; y < c_h; y++)
+    blur_line (tmp + y * c_w * 4, c_w * 4, kernel, length, c + y * c_w * 4, 4, c_w);
+
+  for (i = 0; i < c_w * c_h * 4; i++)
+    c[i] *= o->value;
+  babl_process (babl_fish (premul, bytes), c, d_u8, c_w * c_h);
+
+  for (y = 0; y < h; y++)
+    rock_median_row (d_u8 + y * c_w * 4, c_w, SMOOTH_RADIUS, half, 1.0, o->alpha_percentile2, hist,
+                     e + y * w * 4, w);
+  babl_process (babl_fish (median, premul), e, e, w * h);
+
+  /* The finished pixels over their xor with the median, dst-atop the edge */
+  for (y = 0; y < h; y++)
+    babl_process (babl_fish (linear, premul), f + ((y + f_off) * f_w + f_off) * 4,
+                  out + y * w * 4, w);
+
+  for (y = 0; y < h; y++)
+    for (x = 0; x < w; x++)
+      {
+        gfloat       *g  = out + (y * w + x) * 4;
+        const gfloat *m  = a + ((y + a_off) * a_w + x + a_off) * 4;
+        const gfloat *ed = e + (y * w + x) * 4;
+        gfloat        xa = m[3] + g[3] - 2.0f * m[3] * g[3];
+        gfloat        ga;
+
+        for (k = 0; k < 3; k++)
+          {
+            gfloat xc = m[k] * (1.0f - g[3]) + g[k] * (1.0f - m[3]);
+
+            g[k] = xc + g[k] * (1.0f - xa);
+          }
+        g[3] = xa + g[3] * (1.0f - xa);
+
+        ga = g[3];
+        for (k = 0; k < 3; k++)
+          g[k] = g[k] * ed[3] + ed[k] * (1.0f - ga);
+        g[3] = ed[3];
+      }
+}
+
+static gboolean
+process (GeglOperation       *operation,
+         GeglBuffer          *input,
+         GeglBuffer          *aux,
+         GeglBuffer          *output,
+         const GeglRectangle *result,
+         gint                 level)
+{
+  GeglProperties *o      = GEGL_PROPERTIES (operation);
+  const Babl     *space  = babl_format_get_space (gegl_operation_get_format (operation, "input"));
+  SmoothRects     rects;
+  GeglRectangle   f_rect = *result;
+  gsize           row_bytes, f_bytes, total;
+  RockArena      *arena;
+  gfloat         *ring[3];
+  gfloat         *aux_row;
+  gfloat         *f_buf;
+
+  if (o->edgesmooth)
+    {
+      smooth_rects (o, result, &rects);
+      f_rect = rects.f_rect;
+    }
+
+  row_bytes = sizeof (gfloat) * (f_rect.width + 2 * HALO) * 4;
+  f_bytes   = sizeof (gfloat) * f_rect.width * f_rect.height * 4;
+  total     = 4 * ROCK_ARENA_SIZE (row_bytes) + ROCK_ARENA_SIZE (f_bytes);
+  if (o->edgesmooth)
+    total += smooth_scratch_size (&rects, result);
+
+  arena   = rock_arena_begin (total);
+  ring[0] = rock_arena_alloc (arena, row_bytes);
+  ring[1] = rock_arena_alloc (arena, row_bytes);
+  ring[2] = rock_arena_alloc (arena, row_bytes);
+  aux_row = rock_arena_alloc (arena, row_bytes);
+  f_buf   = rock_arena_alloc (arena, f_bytes);
+
+  finish_rect (operation, input, aux, &f_rect, ring, aux_row, f_buf);
+
+  if (o->edgesmooth)
+    {
+      GeglRectangle box = finish_box (operation);
+      gfloat       *out = rock_arena_alloc (arena, sizeof (gfloat) * result->width * result->height * 4);
+
+      smooth_edges (o, space, &rects, &box, f_buf, result, arena, out);
+      gegl_buffer_set (output, result, 0, babl_format_with_space ("RaGaBaA float", space),
+                       out, GEGL_AUTO_ROWSTRIDE);
+    }
+  else
+    {
+      gegl_buffer_set (output, result, 0, babl_format_with_space ("RGBA float", space),
+                       f_buf, GEGL_AUTO_ROWSTRIDE);
+    }
+
+  rock_arena_end (arena);
+
+  return TRUE;
+}
+
+static void
+gegl_op_class_init (GeglOpClass *klass)
+{
+  GeglOperationClass         *operation_class;
+  GeglOperationComposerClass *composer_class;
+
+  operation_class = GEGL_OPERATION_CLASS (klass);
+  composer_class  = GEGL_OPERATION_COMPOSER_CLASS (klass);
+
+  operation_class->prepare                   = prepare;
+  operation_class->get_bounding_box          = get_bounding_box;
+  operation_class->get_required_for_output   = get_required_for_output;
+  operation_class->get_invalidated_by_change = get_invalidated_by_change;
+  operation_class->threaded                  = TRUE;
+  composer_class->process                    = process;
+
+  gegl_operation_class_set_keys (operation_class,
+    "name",        "lb:rock-finish",
+    "title",       _("Rock Text finish"),
+    "categories",  "hidden",
+    "reference-hash", "8b02e4f7a61d35c9a0f3b2ac",
+    "description", _("Grain over, mean curvature blur, exposure and optionally edge smoothing in one pass. Used inside Rock Text"),
+    NULL);
+}
+
+#endif
@@ -0,0 +1,56 @@
+/* This file is part of the GEGL Rock Text operations
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Format negotiation for the rock text helper ops. An op that can work on linear float RGBA either
+premultiplied or not takes whichever of the two its producer already delivers, so the pixels are not
+converted on the way in; and hands the same format on, so they are not converted on the way out.
+Each op includes it directly, everything in here is static.
+ */
+
+#pragma once
+
+#include <gegl.h>
+
+/* The linear float RGBA format pad is fed with, "RGBA float" or
+ * "RaGaBaA float" in the source space. Anything else falls back to
+ * fallback (a format name), converted once on the way in.
+ */
+static const Babl *
+rock_format_negotiate (GeglOperation *operation,
+                       const gchar   *pad,
+                       const gchar   *fallback,
+                       gboolean      *premultiplied)
+{
+  const Babl *space  = gegl_operation_get_source_space (operation, pad);
+  const Babl *source = gegl_operation_get_source_format (operation, pad);
+  const Babl *straight = babl_format_with_space ("RGBA float", space);
+  const Babl *premul   = babl_format_with_space ("RaGaBaA float", space);
+  const Babl *format;
+
+  if (source == straight || source == premul)
+    format = source;
+  else
+    format = babl_format_with_space (fallback, space);
+
+  if (premultiplied)
+    *premultiplied = format == premul;
+
+  return format;
+}
@@ -0,0 +1,140 @@
+/* This file is part of the GEGL Rock Text operations
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Sliding percentile histograms over the circle neighborhood gegl:median-blur uses, on R'G'B'A u8 with color
+weighted by alpha. Shared by lb:rock-median and the edge smoothing of lb:rock-finish. Each op includes it
+directly, everything in here is static.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+#include "rock-dispatch.h"
+
+#define ROCK_HISTOGRAM_FINE   256
+#define ROCK_HISTOGRAM_COARSE 16
+
+typedef struct
+{
+  guint32 fine[4][ROCK_HISTOGRAM_FINE];
+  guint32 coarse[4][ROCK_HISTOGRAM_COARSE];
+  guint32 total[4];
+} RockHistogram;
+
+/* Half width of every row of the circle, like gegl:median-blur draws it */
+static void
+rock_circle_rows (gint  radius,
+                  gint *half)
+{
+  gint dy;
+
+  for (dy = -radius; dy <= radius; dy++)
+    half[dy + radius] = (gint) sqrt ((radius + 0.5) * (radius + 0.5) - dy * dy);
+}
+
+static inline void
+rock_histogram_change (RockHistogram *hist,
+                       const guchar  *pixel,
+                       gint           sign)
+{
+  gint a = pixel[3];
+  gint c;
+
+  for (c = 0; c < 3; c++)
+    {
+      hist->fine[c][pixel[c]]         += sign * a;
+      hist->coarse[c][pixel[c] >> 4]  += sign * a;
+    }
+  hist->total[0] += sign * a;
+
+  hist->fine[3][a]        += sign;
+  hist->coarse[3][a >> 4] += sign;
+  hist->total[3]          += sign;
+}
+
+/* The bin where the running count first passes percentile of total */
+static inline gint
+rock_histogram_percentile (const RockHistogram *hist,
+                           gint                 c,
+                           guint32              total,
+                           gdouble              percentile)
+{
+  guint32 target, sum = 0;
+  gint    coarse = 0, bin;
+
+  if (!total)
+    return 0;
+
+  target = MIN ((guint32) (percentile / 100.0 * total), total - 1);
+
+  while (coarse < ROCK_HISTOGRAM_COARSE - 1 && sum + hist->coarse[c][coarse] <= target)
+    sum += hist->coarse[c][coarse++];
+
+  for (bin = coarse * (ROCK_HISTOGRAM_FINE / ROCK_HISTOGRAM_COARSE);
+       bin < ROCK_HISTOGRAM_FINE - 1; bin++)
+    {
+      if (sum + hist->fine[c][bin] > target)
+        break;
+      sum += hist->fine[c][bin];
+    }
+
+  return bin;
+}
+
+/* One output row. src is the padded window, src_w wide, with row 0 of the
+ * circle of the first output pixel at src.
+ */
+ROCK_KERNEL static void
+rock_median_row (const guchar  *src,
+                 gint           src_w,
+                 gint           radius,
+                 const gint    *half,
+                 gdouble        percentile,
+                 gdouble        alpha_percentile,
+                 RockHistogram *hist,
+                 gfloat        *out,
+                 gint           width)
+{
+  gint x, dy, dx, c;
+
+  memset (hist, 0, sizeof (RockHistogram));
+
+  for (dy = 0; dy <= 2 * radius; dy++)
+    for (dx = radius - half[dy]; dx <= radius + half[dy]; dx++)
+      rock_histogram_change (hist, src + (dy * src_w + dx) * 4, 1);
+
+  for (x = 0; x < width; x++)
+    {
+      if (x > 0)
+        for (dy = 0; dy <= 2 * radius; dy++)
+          {
+            const guchar *row = src + dy * src_w * 4;
+
+            rock_histogram_change (hist, row + (x - 1 + radius - half[dy]) * 4, -1);
+            rock_histogram_change (hist, row + (x + radius + half[dy]) * 4, 1);
+          }
+
+      for (c = 0; c < 3; c++)
+        out[x * 4 + c] = rock_histogram_percentile (hist, c, hist->total[0], percentile) / 255.0f;
+      out[x * 4 + 3] = rock_histogram_percentile (hist, 3, hist->total[3], alpha_percentile) / 255.0f;
+    }
+}
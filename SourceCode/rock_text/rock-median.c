@@ -0,0 +1,190 @@
+/* This file is an image processing operation for GEGL
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Internal part of Rock Text. A percentile filter for the small radii rock text uses, in place of gegl:median-blur
+with its default circle neighborhood and no abyss. Every channel is quantized to 8 bits and kept in a sliding
+two level histogram (16 coarse bins over 256 fine ones), so moving one pixel right only touches the two edge
+columns of the circle and a percentile is found in at most 32 steps. Color is weighted by alpha, like
+gegl:median-blur does, so transparent pixels do not pull the color of the edges.
+ */
+
+#include "config.h"
+#include <glib/gi18n-lib.h>
+
+#ifdef GEGL_PROPERTIES
+
+property_int (radius, _("Radius"), 1)
+  description (_("Radius of the circle around every pixel"))
+  value_range (0, 10)
+  ui_meta     ("unit", "pixel-distance")
+
+property_double (percentile, _("Percentile"), 50.0)
+  description (_("Percentile of the color channels, 50 is the median"))
+  value_range (0.0, 100.0)
+
+property_double (alpha_percentile, _("Alpha percentile"), 50.0)
+  description (_("Percentile of the alpha channel, 50 is the median"))
+  value_range (0.0, 100.0)
+
+#else
+
+#define GEGL_OP_FILTER
+#define GEGL_OP_NAME     rock_median
+#define GEGL_OP_C_SOURCE rock-median.c
+
+#include "gegl-op.h"
+#include "rock-arena.h"
+#include "rock-histogram.h"
+
+static void
+prepare (GeglOperation *operation)
+{
+  const Babl *space = gegl_operation_get_source_space (operation, "input");
+
+  gegl_operation_set_format (operation, "input",
+                             babl_format_with_space ("R'G'B'A u8", space));
+  gegl_operation_set_format (operation, "output",
+                             babl_format_with_space ("R'G'B'A float", space));
+}
+
+static GeglRectangle
+get_bounding_box (GeglOperation *operation)
+{
+  GeglProperties *o       = GEGL_PROPERTIES (operation);
+  GeglRectangle  *in_rect = gegl_operation_source_get_bounding_box (operation, "input");
+  GeglRectangle   rect;
+
+  if (!in_rect)
+    return *GEGL_RECTANGLE (0, 0, 0, 0);
+
+  /* Without an abyss the circle grows the shape by up to its radius */
+  rect = *in_rect;
+  if (!gegl_rectangle_is_infinite_plane (&rect))
+    {
+      rect.x      -= o->radius;
+      rect.y      -= o->radius;
+      rect.width  += 2 * o->radius;
+      rect.height += 2 * o->radius;
+    }
+
+  return rect;
+}
+
+static GeglRectangle
+get_required_for_output (GeglOperation       *operation,
+                         const gchar         *input_pad,
+                         const GeglRectangle *roi)
+{
+  GeglProperties *o    = GEGL_PROPERTIES (operation);
+  GeglRectangle   rect = *roi;
+
+  rect.x      -= o->radius;
+  rect.y      -= o->radius;
+  rect.width  += 2 * o->radius;
+  rect.height += 2 * o->radius;
+
+  return rect;
+}
+
+static GeglRectangle
+get_invalidated_by_change (GeglOperation       *operation,
+                           const gchar         *input_pad,
+                           const GeglRectangle *input_region)
+{
+  return get_required_for_output (operation, input_pad, input_region);
+}
+
+static gboolean
+process (GeglOperation       *operation,
+         GeglBuffer          *input,
+         GeglBuffer          *output,
+         const GeglRectangle *result,
+         gint                 level)
+{
+  GeglProperties *o      = GEGL_PROPERTIES (operation);
+  GeglRectangle   window = get_required_for_output (operation, "input", result);
+  gint            n_in   = window.width * window.height;
+  gint            n_out  = result->width * result->height;
+  RockArena      *arena;
+  RockHistogram  *hist;
+  guchar         *src;
+  gfloat         *out;
+  gint           *half;
+  gint            y;
+
+  if (n_out <= 0)
+    return TRUE;
+
+  arena = rock_arena_begin (ROCK_ARENA_SIZE (n_in * 4) +
+                            ROCK_ARENA_SIZE (sizeof (gfloat) * n_out * 4) +
+                            ROCK_ARENA_SIZE (sizeof (gint) * (2 * o->radius + 1)) +
+                            ROCK_ARENA_SIZE (sizeof (RockHistogram)));
+  src  = rock_arena_alloc (arena, n_in * 4);
+  out  = rock_arena_alloc (arena, sizeof (gfloat) * n_out * 4);
+  half = rock_arena_alloc (arena, sizeof (gint) * (2 * o->radius + 1));
+  hist = rock_arena_alloc (arena, sizeof (RockHistogram));
+
+  /* Outside the input is transparent, which is what abyss-policy none does */
+  gegl_buffer_get (input, &window, 1.0,
+                   gegl_operation_get_format (operation, "input"), src,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  rock_circle_rows (o->radius, half);
+
+  for (y = 0; y < result->height; y++)
+    rock_median_row (src + y * window.width * 4, window.width, o->radius, half,
+                     o->percentile, o->alpha_percentile, hist,
+                     out + y * result->width * 4, result->width);
+
+  gegl_buffer_set (output, result, 0,
+                   gegl_operation_get_format (operation, "output"), out,
+                   GEGL_AUTO_ROWSTRIDE);
+
+  rock_arena_end (arena);
+
+  return TRUE;
+}
+
+static void
+gegl_op_class_init (GeglOpClass *klass)
+{
+  GeglOperationClass       *operation_class;
+  GeglOperationFilterClass *filter_class;
+
+  operation_class = GEGL_OPERATION_CLASS (klass);
+  filter_class    = GEGL_OPERATION_FILTER_CLASS (klass);
+
+  operation_class->prepare                   = prepare;
+  operation_class->get_bounding_box          = get_bounding_box;
+  operation_class->get_required_for_output   = get_required_for_output;
+  operation_class->get_invalidated_by_change = get_invalidated_by_change;
+  operation_class->threaded                  = TRUE;
+  filter_class->process                      = process;
+
+  gegl_operation_class_set_keys (operation_class,
+    "name",        "lb:rock-median",
+    "title",       _("Rock Text median"),
+    "categories",  "hidden",
+    "reference-hash", "d83a0f6c19be27e45a7c12ac",
+    "description", _("Percentile filter for small radii on 8 bit histograms, with color weighted by alpha. Used inside Rock Text"),
+    NULL);
+}
+
+#endif
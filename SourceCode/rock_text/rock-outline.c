@@ -0,0 +1,457 @@
+/* This file is an image processing operation for GEGL
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Internal part of Rock Text. The same outline gegl:dropshadow draws, with the same property names, but
+done in one node that only works on the alpha channel: the grow is a distance transform, the blur
+only blurs alpha, and the shadow is composited under the input in the same pass. With an opacity of
+0 the input is passed through untouched.
+ */
+
+#include "config.h"
+#include <glib/gi18n-lib.h>
+
+#ifdef GEGL_PROPERTIES
+
+property_double (x, _("X"), 20.0)
+  description   (_("Horizontal shadow offset"))
+  ui_range      (-40.0, 40.0)
+  ui_steps      (1, 10)
+  ui_meta       ("unit", "pixel-distance")
+  ui_meta       ("axis", "x")
+
+property_double (y, _("Y"), 20.0)
+  description   (_("Vertical shadow offset"))
+  ui_range      (-40.0, 40.0)
+  ui_steps      (1, 10)
+  ui_meta       ("unit", "pixel-distance")
+  ui_meta       ("axis", "y")
+
+property_double (radius, _("Blur radius"), 10.0)
+  value_range   (0.0, G_MAXDOUBLE)
+  ui_range      (0.0, 300.0)
+  ui_steps      (1, 5)
+  ui_gamma      (1.5)
+  ui_meta       ("unit", "pixel-distance")
+
+property_double (grow_radius, _("Grow radius"), 0.0)
+  value_range   (-100.0, 100.0)
+  ui_range      (-50.0, 50.0)
+  ui_digits     (0)
+  ui_steps      (1, 5)
+  ui_gamma      (1.5)
+  ui_meta       ("unit", "pixel-distance")
+  description (_("The distance to expand the shadow before blurring; a negative value will contract the shadow instead"))
+
+property_color  (color, _("Color"), "black")
+  description   (_("The shadowꞌs color"))
+
+property_double (opacity, _("Opacity"), 0.5)
+  value_range   (0.0, 2.0)
+  ui_steps      (0.01, 0.10)
+
+#else
+
+#define GEGL_OP_FILTER
+#define GEGL_OP_NAME     rock_outline
+#define GEGL_OP_C_SOURCE rock-outline.c
+
+#include "gegl-op.h"
+#include "rock-edt.h"
+#include "rock-arena.h"
+#include "rock-format.h"
+#include "rock-dispatch.h"
+
+/* Same kernel length as the FIR gegl:gaussian-blur uses */
+static gint
+blur_radius (GeglProperties *o)
+{
+  return o->radius > 0.0001 ? 3 * (gint) ceil (o->radius) : 0;
+}
+
+static gint
+grow_reach (GeglProperties *o)
+{
+  return (gint) ceil (fabs (o->grow_radius));
+}
+
+static GeglRectangle
+grow_rect (const GeglRectangle *rect,
+           gint                 amount)
+{
+  GeglRectangle grown = *rect;
+
+  grown.x      -= amount;
+  grown.y      -= amount;
+  grown.width  += 2 * amount;
+  grown.height += 2 * amount;
+
+  return grown;
+}
+
+/* Where the unshifted shadow is needed to cover roi, one extra pixel on the
+ * low side for the bilinear translate.
+ */
+static GeglRectangle
+shadow_rect (GeglProperties      *o,
+             const GeglRectangle *roi)
+{
+  GeglRectangle rect = *roi;
+
+  rect.x      -= (gint) floor (o->x) + 1;
+  rect.y      -= (gint) floor (o->y) + 1;
+  rect.width  += 1;
+  rect.height += 1;
+
+  return rect;
+}
+
+/* Only alpha is read and the composite works either way, so the input
+ * format is whatever linear float RGBA comes in.
+ */
+static void
+prepare (GeglOperation *operation)
+{
+  const Babl *format = rock_format_negotiate (operation, "input", "RaGaBaA float", NULL);
+
+  gegl_operation_set_format (operation, "input",  format);
+  gegl_operation_set_format (operation, "output", format);
+}
+
+static GeglRectangle
+get_bounding_box (GeglOperation *operation)
+{
+  GeglProperties *o       = GEGL_PROPERTIES (operation);
+  GeglRectangle  *in_rect = gegl_operation_source_get_bounding_box (operation, "input");
+  GeglRectangle   shadow;
+  GeglRectangle   result;
+
+  if (!in_rect)
+    return *GEGL_RECTANGLE (0, 0, 0, 0);
+
+  if (o->opacity == 0.0)
+    return *in_rect;
+
+  shadow = grow_rect (in_rect, grow_reach (o) + blur_radius (o) + 1);
+  shadow.x += (gint) floor (o->x);
+  shadow.y += (gint) floor (o->y);
+
+  gegl_rectangle_bounding_box (&result, in_rect, &shadow);
+  return result;
+}
+
+static GeglRectangle
+get_required_for_output (GeglOperation       *operation,
+                         const gchar         *input_pad,
+                         const GeglRectangle *roi)
+{
+  GeglProperties *o = GEGL_PROPERTIES (operation);
+  GeglRectangle   shadow;
+  GeglRectangle   result;
+
+  if (o->opacity == 0.0)
+    return *roi;
+
+  shadow = shadow_rect (o, roi);
+  shadow = grow_rect (&shadow, grow_reach (o) + blur_radius (o));
+
+  gegl_rectangle_bounding_box (&result, roi, &shadow);
+  return result;
+}
+
+static GeglRectangle
+get_invalidated_by_change (GeglOperation       *operation,
+                           const gchar         *input_pad,
+                           const GeglRectangle *input_region)
+{
+  GeglProperties *o = GEGL_PROPERTIES (operation);
+  GeglRectangle   shadow;
+  GeglRectangle   result;
+
+  if (o->opacity == 0.0)
+    return *input_region;
+
+  shadow = grow_rect (input_region, grow_reach (o) + blur_radius (o) + 1);
+  shadow.x += (gint) floor (o->x);
+  shadow.y += (gint) floor (o->y);
+
+  gegl_rectangle_bounding_box (&result, input_region, &shadow);
+  return result;
+}
+
+/* Grows (or shrinks) the alpha plane by o->grow_radius with a distance
+ * transform of the thresholded alpha.
+ */
+static void
+grow_alpha (GeglProperties *o,
+            gfloat         *alpha,
+            gint            width,
+            gint            height,
+            RockArena      *arena)
+{
+  gboolean grow = o->grow_radius > 0.0;
+  gfloat   r    = fabs (o->grow_radius);
+  gint     n    = width * height;
+  gfloat  *dist = rock_arena_alloc (arena, sizeof (gfloat) * n);
+  gint     i;
+
+  /* grow: distance to the nearest opaque pixel, shrink: to the nearest clear one */
+  for (i = 0; i < n; i++)
+    dist[i] = ((alpha[i] > 0.5f) == grow) ? 0.0f : ROCK_EDT_INF;
+
+  rock_edt_2d (dist, width, height, arena);
+
+  for (i = 0; i < n; i++)
+    if (dist[i] <= r)
+      alpha[i] = grow ? 1.0f : 0.0f;
+}
+
+/* Separable gaussian on the alpha plane, src is (width + 2 * radius) x
+ * (height + 2 * radius), dst is width x height.
+ */
+ROCK_KERNEL static void
+blur_alpha (GeglProperties *o,
+            const gfloat   *src,
+            gfloat         *dst,
+            gint            width,
+            gint            height,
+            gint            radius,
+            RockArena      *arena)
+{
+  gint    src_width = width + 2 * radius;
+  gint    length    = 2 * radius + 1;
+  gfloat *kernel    = rock_arena_alloc (arena, sizeof (gfloat) * length);
+  gfloat *tmp       = rock_arena_alloc (arena, sizeof (gfloat) * width * (height + 2 * radius));
+  gfloat  sum       = 0.0f;
+  gint    x, y, k;
+
+  for (k = 0; k < length; k++)
+    {
+      gfloat d = k - radius;
+
+      kernel[k] = expf (-(d * d) / (2.0f * o->radius * o->radius));
+      sum += kernel[k];
+    }
+  for (k = 0; k < length; k++)
+    kernel[k] /= sum;
+
+  for (y = 0; y < height + 2 * radius; y++)
+    {
+      const gfloat *in  = src + y * src_width;
+      gfloat       *out = tmp + y * width;
+
+      for (x = 0; x < width; x++)
+        {
+          gfloat acc = 0.0f;
+
+          for (k = 0; k < length; k++)
+            acc += in[x + k] * kernel[k];
+          out[x] = acc;
+        }
+    }
+
+  for (y = 0; y < height; y++)
+    {
+      gfloat *out = dst + y * width;
+
+      for (x = 0; x < width; x++)
+        out[x] = 0.0f;
+
+      for (k = 0; k < length; k++)
+        {
+          const gfloat *in = tmp + (y + k) * width;
+          gfloat        w  = kernel[k];
+
+          for (x = 0; x < width; x++)
+            out[x] += in[x] * w;
+        }
+    }
+}
+
+static gboolean
+process (GeglOperation       *operation,
+         GeglBuffer          *input,
+         GeglBuffer          *output,
+         const GeglRectangle *result,
+         gint                 level)
+{
+  GeglProperties *o       = GEGL_PROPERTIES (operation);
+  const Babl     *format  = gegl_operation_get_format (operation, "output");
+  const Babl     *space   = babl_format_get_space (format);
+  gboolean        premul  = format == babl_format_with_space ("RaGaBaA float", space);
+  gint            blur_r  = blur_radius (o);
+  GeglRectangle   s_rect  = shadow_rect (o, result);
+  GeglRectangle   g_rect  = grow_rect (&s_rect, blur_r);
+  GeglRectangle   a_rect  = grow_rect (&g_rect, grow_reach (o));
+  gint            reach   = grow_reach (o);
+  gint            a_n     = a_rect.width * a_rect.height;
+  gint            g_n     = g_rect.width * g_rect.height;
+  gint            s_n     = s_rect.width * s_rect.height;
+  gint            n       = result->width * result->height;
+  RockArena      *arena;
+  gfloat         *rgba, *alpha, *shadow;
+  gfloat          color[4];
+  gfloat          fx      = o->x - floor (o->x);
+  gfloat          fy      = o->y - floor (o->y);
+  gint            x, y, i;
+
+  arena  = rock_arena_begin (ROCK_ARENA_SIZE (sizeof (gfloat) * MAX (a_n, n) * 4) +
+                             ROCK_ARENA_SIZE (sizeof (gfloat) * a_n) +
+                             ROCK_ARENA_SIZE (sizeof (gfloat) * s_n) +
+                             (o->grow_radius != 0.0 ?
+                              ROCK_ARENA_SIZE (sizeof (gfloat) * a_n) +
+                              rock_edt_scratch_size (a_rect.width, a_rect.height) : 0) +
+                             (reach ? ROCK_ARENA_SIZE (sizeof (gfloat) * g_n) : 0) +
+                             (blur_r ?
+                              ROCK_ARENA_SIZE (sizeof (gfloat) * (2 * blur_r + 1)) +
+                              ROCK_ARENA_SIZE (sizeof (gfloat) * s_rect.width * g_rect.height) : 0));
+  rgba   = rock_arena_alloc (arena, sizeof (gfloat) * MAX (a_n, n) * 4);
+  alpha  = rock_arena_alloc (arena, sizeof (gfloat) * a_n);
+  shadow = rock_arena_alloc (arena, sizeof (gfloat) * s_n);
+
+  /* The color is straight, whichever form the composite below uses */
+  gegl_color_get_pixel (o->color, babl_format_with_space ("RGBA float", space), color);
+
+  gegl_buffer_get (input, &a_rect, 1.0, format, rgba,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  for (i = 0; i < a_n; i++)
+    alpha[i] = rgba[i * 4 + 3];
+
+  if (o->grow_radius != 0.0)
+    grow_alpha (o, alpha, a_rect.width, a_rect.height, arena);
+
+  /* a_rect only differs from g_rect by the grow reach, crop it away */
+  {
+    gfloat *grown = alpha;
+
+    if (reach)
+      {
+        grown = rock_arena_alloc (arena, sizeof (gfloat) * g_n);
+        for (y = 0; y < g_rect.height; y++)
+          memcpy (grown + y * g_rect.width,
+                  alpha + (y + reach) * a_rect.width + reach,
+                  sizeof (gfloat) * g_rect.width);
+      }
+
+    if (blur_r)
+      blur_alpha (o, grown, shadow, s_rect.width, s_rect.height, blur_r, arena);
+    else
+      memcpy (shadow, grown, sizeof (gfloat) * s_n);
+  }
+
+  /* Shadow under the input, translated by (x, y) with a bilinear sample */
+  gegl_buffer_get (input, result, 1.0, format, rgba,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  for (y = 0; y < result->height; y++)
+    {
+      const gfloat *s0  = shadow + y * s_rect.width;
+      const gfloat *s1  = s0 + s_rect.width;
+      gfloat       *out = rgba + y * result->width * 4;
+
+      for (x = 0; x < result->width; x++)
+        {
+          gfloat a = fx * fy * s0[x] + (1.0f - fx) * fy * s0[x + 1] +
+                     fx * (1.0f - fy) * s1[x] + (1.0f - fx) * (1.0f - fy) * s1[x + 1];
+          gfloat sa  = a * color[3] * o->opacity;
+          gfloat inv = 1.0f - out[3];
+
+          if (premul)
+            {
+              out[0] += color[0] * sa * inv;
+              out[1] += color[1] * sa * inv;
+              out[2] += color[2] * sa * inv;
+              out[3] += sa * inv;
+            }
+          else
+            {
+              gfloat under = sa * inv;
+              gfloat total = out[3] + under;
+
+              if (total > 0.0f)
+                {
+                  out[0] = (out[0] * out[3] + color[0] * under) / total;
+                  out[1] = (out[1] * out[3] + color[1] * under) / total;
+                  out[2] = (out[2] * out[3] + color[2] * under) / total;
+                }
+              out[3] = total;
+            }
+
+          out += 4;
+        }
+    }
+
+  gegl_buffer_set (output, result, 0, format, rgba, GEGL_AUTO_ROWSTRIDE);
+
+  rock_arena_end (arena);
+
+  return TRUE;
+}
+
+/* Nothing to draw, hand the input on as it is */
+static gboolean
+operation_process (GeglOperation        *operation,
+                   GeglOperationContext *context,
+                   const gchar          *output_prop,
+                   const GeglRectangle  *result,
+                   gint                  level)
+{
+  GeglProperties *o = GEGL_PROPERTIES (operation);
+
+  if (o->opacity == 0.0)
+    {
+      gpointer in = gegl_operation_context_get_object (context, "input");
+
+      gegl_operation_context_take_object (context, "output",
+                                          g_object_ref (G_OBJECT (in)));
+      return TRUE;
+    }
+
+  return GEGL_OPERATION_CLASS (gegl_op_parent_class)->process (operation, context,
+                                                               output_prop, result,
+                                                               level);
+}
+
+static void
+gegl_op_class_init (GeglOpClass *klass)
+{
+  GeglOperationClass       *operation_class;
+  GeglOperationFilterClass *filter_class;
+
+  operation_class = GEGL_OPERATION_CLASS (klass);
+  filter_class    = GEGL_OPERATION_FILTER_CLASS (klass);
+
+  operation_class->prepare                   = prepare;
+  operation_class->process                   = operation_process;
+  operation_class->get_bounding_box          = get_bounding_box;
+  operation_class->get_required_for_output   = get_required_for_output;
+  operation_class->get_invalidated_by_change = get_invalidated_by_change;
+  operation_class->threaded                  = TRUE;
+  filter_class->process                      = process;
+
+  gegl_operation_class_set_keys (operation_class,
+    "name",        "lb:rock-outline",
+    "title",       _("Rock Text outline"),
+    "categories",  "hidden",
+    "reference-hash", "5e90c3a1f27b4d68e1a4b2ac",
+    "description", _("Alpha only drop shadow composited under the input in one pass. Used inside Rock Text"),
+    NULL);
+}
+
+#endif
@@ -0,0 +1,317 @@
+/* This file is an image processing operation for GEGL
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Internal part of Rock Text. Noise spread with cached displacements. Every pixel is replaced by a pixel at a
+random offset, drawn from GeglRandom with the absolute pixel coordinates the way gegl:noise-spread draws it, so
+for one seed and amount the offsets never change. They are kept as int8 planes, one per SPREAD_TILE square tile,
+shared by every node of the process: a render with the same seed and amounts, of another layer or another
+variant, only gathers pixels and draws no random numbers at all.
+ */
+
+#include "config.h"
+#include <glib/gi18n-lib.h>
+
+#ifdef GEGL_PROPERTIES
+
+property_int    (amount_x, _("Horizontal"), 5)
+    description (_("Horizontal spread amount"))
+    value_range (0, 112)
+    ui_meta     ("unit", "pixel-distance")
+    ui_meta     ("axis", "x")
+
+property_int    (amount_y, _("Vertical"), 5)
+    description (_("Vertical spread amount"))
+    value_range (0, 112)
+    ui_meta     ("unit", "pixel-distance")
+    ui_meta     ("axis", "y")
+
+property_seed   (seed, _("Random seed"), rand)
+
+#else
+
+#define GEGL_OP_FILTER
+#define GEGL_OP_NAME     rock_spread
+#define GEGL_OP_C_SOURCE rock-spread.c
+
+#include "gegl-op.h"
+#include "rock-arena.h"
+#include "rock-format.h"
+#include "rock-dispatch.h"
+
+#define SPREAD_TILE 64
+
+/* 8 KiB a tile, so at most 32 MiB of offsets */
+#define SPREAD_CACHE_MAX_ENTRIES 4096
+
+/* How many pixels ahead the gather asks for its source */
+#define SPREAD_PREFETCH 8
+
+#if defined (__GNUC__)
+#  define spread_prefetch(p) __builtin_prefetch ((p), 0, 0)
+#else
+#  define spread_prefetch(p)
+#endif
+
+static GHashTable *spread_cache = NULL;
+static GMutex      spread_mutex;
+
+static gint
+floor_div (gint a,
+           gint b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/* The x offsets of the tile followed by its y offsets, row by row */
+static GBytes *
+make_offsets (GeglProperties *o,
+              gint            tx,
+              gint            ty)
+{
+  gint8 *offsets = g_new (gint8, 2 * SPREAD_TILE * SPREAD_TILE);
+  gint8 *dx      = offsets;
+  gint8 *dy      = offsets + SPREAD_TILE * SPREAD_TILE;
+  gint   x, y;
+
+  for (y = 0; y < SPREAD_TILE; y++)
+    for (x = 0; x < SPREAD_TILE; x++)
+      {
+        gint    px    = tx * SPREAD_TILE + x;
+        gint    py    = ty * SPREAD_TILE + y;
+        gint    xdist = o->amount_x > 0 ?
+                        gegl_random_int_range (o->rand, px, py, 0, 0, -o->amount_x, o->amount_x + 1) : 0;
+        gint    ydist = o->amount_y > 0 ?
+                        gegl_random_int_range (o->rand, px, py, 0, 1, -o->amount_y, o->amount_y + 1) : 0;
+        gdouble angle = gegl_random_float_range (o->rand, px, py, 0, 2, -G_PI, G_PI);
+
+        dx[y * SPREAD_TILE + x] = (gint8) floor (sin (angle) * xdist);
+        dy[y * SPREAD_TILE + x] = (gint8) floor (cos (angle) * ydist);
+      }
+
+  return g_bytes_new_take (offsets, 2 * SPREAD_TILE * SPREAD_TILE);
+}
+
+static GBytes *
+lookup_offsets (GeglProperties *o,
+                gint            tx,
+                gint            ty)
+{
+  GBytes *offsets;
+  gchar  *key = g_strdup_printf ("%d %d %d %d %d", o->seed,
+                                 o->amount_x, o->amount_y, tx, ty);
+
+  g_mutex_lock (&spread_mutex);
+  if (!spread_cache)
+    spread_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, (GDestroyNotify) g_bytes_unref);
+  offsets = g_hash_table_lookup (spread_cache, key);
+  if (offsets)
+    g_bytes_ref (offsets);
+  g_mutex_unlock (&spread_mutex);
+
+  if (offsets)
+    {
+      g_free (key);
+      return offsets;
+    }
+
+  /* Drawn without the lock, two threads on the same tile draw the same offsets */
+  offsets = make_offsets (o, tx, ty);
+
+  g_mutex_lock (&spread_mutex);
+  if (g_hash_table_size (spread_cache) >= SPREAD_CACHE_MAX_ENTRIES)
+    g_hash_table_remove_all (spread_cache);
+  g_hash_table_replace (spread_cache, key, g_bytes_ref (offsets));
+  g_mutex_unlock (&spread_mutex);
+
+  return offsets;
+}
+
+static void
+prepare (GeglOperation *operation)
+{
+  const Babl *format = rock_format_negotiate (operation, "input", "RaGaBaA float", NULL);
+
+  gegl_operation_set_format (operation, "input",  format);
+  gegl_operation_set_format (operation, "output", format);
+}
+
+static GeglRectangle
+grow (GeglProperties      *o,
+      const GeglRectangle *rect)
+{
+  GeglRectangle grown = *rect;
+
+  grown.x      -= o->amount_x;
+  grown.y      -= o->amount_y;
+  grown.width  += 2 * o->amount_x;
+  grown.height += 2 * o->amount_y;
+
+  return grown;
+}
+
+static GeglRectangle
+get_bounding_box (GeglOperation *operation)
+{
+  GeglRectangle *in_rect = gegl_operation_source_get_bounding_box (operation, "input");
+
+  if (!in_rect)
+    return *GEGL_RECTANGLE (0, 0, 0, 0);
+  if (gegl_rectangle_is_infinite_plane (in_rect))
+    return *in_rect;
+
+  return grow (GEGL_PROPERTIES (operation), in_rect);
+}
+
+static GeglRectangle
+get_required_for_output (GeglOperation       *operation,
+                         const gchar         *input_pad,
+                         const GeglRectangle *roi)
+{
+  return grow (GEGL_PROPERTIES (operation), roi);
+}
+
+static GeglRectangle
+get_invalidated_by_change (GeglOperation       *operation,
+                           const gchar         *input_pad,
+                           const GeglRectangle *input_region)
+{
+  return grow (GEGL_PROPERTIES (operation), input_region);
+}
+
+/* Copies width pixels of one row of a tile at the offsets dx, dy. src is
+ * the source of the first pixel without an offset, in rows src_w wide.
+ */
+ROCK_KERNEL static void
+gather_row (const gfloat *src,
+            gint          src_w,
+            const gint8  *dx,
+            const gint8  *dy,
+            gfloat       *out,
+            gint          width)
+{
+  gint x;
+
+  for (x = 0; x < width; x++)
+    {
+      const gfloat *s;
+
+      if (x + SPREAD_PREFETCH < width)
+        spread_prefetch (src + (dy[x + SPREAD_PREFETCH] * src_w +
+                                x + SPREAD_PREFETCH + dx[x + SPREAD_PREFETCH]) * 4);
+
+      s = src + (dy[x] * src_w + x + dx[x]) * 4;
+      out[x * 4 + 0] = s[0];
+      out[x * 4 + 1] = s[1];
+      out[x * 4 + 2] = s[2];
+      out[x * 4 + 3] = s[3];
+    }
+}
+
+static gboolean
+process (GeglOperation       *operation,
+         GeglBuffer          *input,
+         GeglBuffer          *output,
+         const GeglRectangle *result,
+         gint                 level)
+{
+  GeglProperties *o      = GEGL_PROPERTIES (operation);
+  const Babl     *format = gegl_operation_get_format (operation, "output");
+  GeglRectangle   window = grow (o, result);
+  gint            n_in   = window.width * window.height;
+  gint            n_out  = result->width * result->height;
+  RockArena      *arena;
+  gfloat         *src, *out;
+  gint            tx0, ty0, tx1, ty1, tx, ty;
+
+  if (n_out <= 0)
+    return TRUE;
+
+  arena = rock_arena_begin (ROCK_ARENA_SIZE (sizeof (gfloat) * n_in * 4) +
+                            ROCK_ARENA_SIZE (sizeof (gfloat) * n_out * 4));
+  src   = rock_arena_alloc (arena, sizeof (gfloat) * n_in * 4);
+  out   = rock_arena_alloc (arena, sizeof (gfloat) * n_out * 4);
+
+  gegl_buffer_get (input, &window, 1.0, format, src,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  tx0 = floor_div (result->x, SPREAD_TILE);
+  ty0 = floor_div (result->y, SPREAD_TILE);
+  tx1 = floor_div (result->x + result->width - 1, SPREAD_TILE);
+  ty1 = floor_div (result->y + result->height - 1, SPREAD_TILE);
+
+  for (ty = ty0; ty <= ty1; ty++)
+    for (tx = tx0; tx <= tx1; tx++)
+      {
+        GBytes      *bytes   = lookup_offsets (o, tx, ty);
+        const gint8 *offsets = g_bytes_get_data (bytes, NULL);
+        gint         x0 = MAX (result->x, tx * SPREAD_TILE);
+        gint         y0 = MAX (result->y, ty * SPREAD_TILE);
+        gint         x1 = MIN (result->x + result->width,  (tx + 1) * SPREAD_TILE);
+        gint         y1 = MIN (result->y + result->height, (ty + 1) * SPREAD_TILE);
+        gint         y;
+
+        for (y = y0; y < y1; y++)
+          {
+            gint i = (y - ty * SPREAD_TILE) * SPREAD_TILE + x0 - tx * SPREAD_TILE;
+
+            gather_row (src + ((y - window.y) * window.width + x0 - window.x) * 4,
+                        window.width,
+                        offsets + i, offsets + SPREAD_TILE * SPREAD_TILE + i,
+                        out + ((y - result->y) * result->width + x0 - result->x) * 4,
+                        x1 - x0);
+          }
+
+        g_bytes_unref (bytes);
+      }
+
+  gegl_buffer_set (output, result, 0, format, out, GEGL_AUTO_ROWSTRIDE);
+
+  rock_arena_end (arena);
+
+  return TRUE;
+}
+
+static void
+gegl_op_class_init (GeglOpClass *klass)
+{
+  GeglOperationClass       *operation_class;
+  GeglOperationFilterClass *filter_class;
+
+  operation_class = GEGL_OPERATION_CLASS (klass);
+  filter_class    = GEGL_OPERATION_FILTER_CLASS (klass);
+
+  operation_class->prepare                   = prepare;
+  operation_class->get_bounding_box          = get_bounding_box;
+  operation_class->get_required_for_output   = get_required_for_output;
+  operation_class->get_invalidated_by_change = get_invalidated_by_change;
+  operation_class->threaded                  = TRUE;
+  filter_class->process                      = process;
+
+  gegl_operation_class_set_keys (operation_class,
+    "name",        "lb:rock-spread",
+    "title",       _("Rock Text noise spread"),
+    "categories",  "hidden",
+    "reference-hash", "a6e20c4d91f7b385c0e4d2ac",
+    "description", _("Noise spread with its random offsets cached per seed, amount and tile. Used inside Rock Text"),
+    NULL);
+}
+
+#endif
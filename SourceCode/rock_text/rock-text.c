@@ -139,6 +139,36 @@ property_int (depth, _("Depth"), 20)
     value_range (20, 100)
     ui_meta ("unit", "degree")
 
+enum_start (rocktextbevel)
+  enum_value (ROCKTEXT_BEVEL_EMBOSS,   "emboss",   N_("Emboss"))
+  enum_value (ROCKTEXT_BEVEL_DISTANCE, "distance", N_("Distance field"))
+enum_end (RockTextBevel)
+
+property_enum (bevel, _("Bevel engine"),
+    RockTextBevel, rocktextbevel,
+    ROCKTEXT_BEVEL_EMBOSS)
+  description (_("Emboss shades the blurred rock. Distance field shades a height map made from the distance to the rockꞌs edge, wide bevels cost no more than narrow ones"))
+ui_meta ("visible", "guichange {legacy}")
+
+enum_start (rocktextbevelprofile)
+  enum_value (ROCKTEXT_PROFILE_LINEAR, "linear", N_("Linear"))
+  enum_value (ROCKTEXT_PROFILE_ROUND,  "round",  N_("Round"))
+  enum_value (ROCKTEXT_PROFILE_SMOOTH, "smooth", N_("Smooth"))
+enum_end (RockTextBevelProfile)
+
+property_enum (bevel_profile, _("Distance bevel profile"),
+    RockTextBevelProfile, rocktextbevelprofile,
+    ROCKTEXT_PROFILE_ROUND)
+  description (_("Shape of the distance field bevel from the edge inwards"))
+ui_meta ("visible", "guichange {legacy}")
+
+property_double (bevel_width, _("Distance bevel width"), 8.0)
+  description (_("Distance from the edge at which the distance field bevel reaches its full height"))
+  value_range (1.0, 200.0)
+  ui_range    (1.0, 60.0)
+  ui_meta     ("unit", "pixel-distance")
+ui_meta ("visible", "guichange {legacy}")
+
 property_double (grains, _("Grains over rock"), 0.8)
   value_range   (0.0, 1.0)
 
@@ -202,6 +232,51 @@ property_double (exposure, _("Darkness to light"), 0.5)
     ui_range    (-2.0, 2.0)
 ui_meta ("visible", "guichange {legacy}")
 
+property_boolean (bounded_reach, _("Bounded reach"), FALSE)
+    description (_("Use the FIR gaussian so every stage only reads a fixed neighborhood. A band, shard or updated rectangle then only computes itself and a fixed border, which bounds its memory and work. The result is not tile dependent either way, but it differs slightly from the recursive gaussian"))
+ui_meta ("visible", "guichange {legacy}")
+
+enum_start (rocktextquality)
+  enum_value (ROCKTEXT_QUALITY_DRAFT,  "draft",  N_("Draft"))
+  enum_value (ROCKTEXT_QUALITY_NORMAL, "normal", N_("Normal"))
+  enum_value (ROCKTEXT_QUALITY_FINAL,  "final",  N_("Final"))
+enum_end (RockTextQuality)
+
+property_enum (quality, _("Quality"),
+    RockTextQuality, rocktextquality,
+    ROCKTEXT_QUALITY_FINAL)
+  description (_("Final is the exact rock text. Normal runs the medians on 8 bit histograms (lb:rock-median) and smooths the edges in the same pass as the grain and exposure (lb:rock-finish), which is faster and close to final; without those helper ops installed it is the same as final. Draft is for previews: a box blur instead of the gaussian, no grain, no mean curvature blur and a single small median instead of edgesmooth"))
+
+enum_start (rocktextresolution)
+  enum_value (ROCKTEXT_RESOLUTION_FULL,    "full",    N_("Full"))
+  enum_value (ROCKTEXT_RESOLUTION_HALF,    "half",    N_("Half"))
+  enum_value (ROCKTEXT_RESOLUTION_QUARTER, "quarter", N_("Quarter"))
+enum_end (RockTextResolution)
+
+property_enum (resolution, _("Rock shape resolution"),
+    RockTextResolution, rocktextresolution,
+    ROCKTEXT_RESOLUTION_FULL)
+  description (_("Size at which the rock shape (noise spread, gaussian, shift and second median) is computed. Half and quarter are much faster on large images; the shape is scaled back up following the edges of the text, and the lighting, colors, grain and edge smoothing stay at full size"))
+ui_meta ("visible", "guichange {legacy}")
+
+property_boolean (noise_cache, _("Cache the rock noise"), FALSE)
+    description (_("Keep the random offsets of the noise spread for every seed and amount, so renders that share them, of any layer, skip drawing random numbers. Needs lb:rock-spread"))
+ui_meta ("visible", "guichange {legacy}")
+
+property_string (text, _("Text (replaces the input layer)"), "")
+    description (_("When set rock text renders this text itself instead of using the input layer. The shaped text mask is cached and reused by later renders of the same text, and its glyphs by later renders of any text in the same font and size"))
+ui_meta ("visible", "guichange {legacy}")
+
+property_string (font, _("Font"), "Sans Bold")
+    description (_("Font used when rock text renders its own text"))
+ui_meta ("visible", "guichange {legacy}")
+
+property_double (font_size, _("Font size"), 120.0)
+    description (_("Font size used when rock text renders its own text"))
+    value_range (1.0, 2048.0)
+    ui_range    (8.0, 400.0)
+ui_meta ("visible", "guichange {legacy}")
+
 
 
 #else
@@ -212,6 +287,10 @@ ui_meta ("visible", "guichange {legacy}")
 
 #include "gegl-op.h"
 
+#ifdef HAVE_PANGOCAIRO
+#include <pango/pangocairo.h>
+#endif
+
 typedef struct
 {
   GeglNode *input;
@@ -242,8 +321,358 @@ typedef struct
   GeglNode *imagefileupload;
   GeglNode *image;
   GeglNode *idref;
+  GeglNode *textmask;
+  GeglNode *prefix;
+  GeglNode *colorize;
+  GeglNode *finish;
+  GeglNode *bevel;
+  GeglNode *shape;
+  GeglNode *boxblur;
+  GeglNode *draftsmooth;
+  GeglNode *fastmedian;
+  GeglNode *fastmedian2;
+  GeglNode *spread;
+  GeglNode *front;
+  GeglNode *down;
+  GeglNode *up;
+  GeglBuffer *mask_from;
+  gint      linked;
 }State;
 
+/* Text mode: the text layer and the internal median blur only depend on the
+ * text, font and median settings, so their result is kept here and shared
+ * by every rock text render of the same string, whatever the seed, color or
+ * overlay. median2 and the gaussian run after noise-spread and thus depend
+ * on the seed, so they are not cached.
+ *
+ * Below that, with pangocairo, every glyph is drawn once per font and size
+ * and kept in a second cache, so a string that was never seen before is only
+ * laid out and has its glyphs copied into place. Pango rounds glyph
+ * positions to whole pixels, so a glyph drawn once fits at every position.
+ * Both caches render without holding their lock; when two threads miss on
+ * the same key both render it and the first one stored is kept.
+ */
+#define TEXT_MASK_CACHE_MAX_ENTRIES 32
+
+static GHashTable *text_mask_cache = NULL;
+static GMutex      text_mask_mutex;
+
+#ifdef HAVE_PANGOCAIRO
+/* Every letter of a few fonts and sizes, about 2 KiB each at 120 px */
+#define GLYPH_CACHE_MAX_ENTRIES 4096
+
+/* The A8 coverage of the glyph follows the header, in rows stride apart */
+typedef struct
+{
+  gint x;       /* of the top left pixel, from the origin of the glyph */
+  gint y;
+  gint width;
+  gint height;
+  gint stride;
+} Glyph;
+
+typedef struct
+{
+  GBytes *glyph;
+  gint    x;
+  gint    y;
+} PlacedGlyph;
+
+static GHashTable *glyph_cache = NULL;
+static GMutex      glyph_mutex;
+
+static GBytes *
+render_glyph (PangoFont  *font,
+              PangoGlyph  id)
+{
+  PangoGlyphString *string = pango_glyph_string_new ();
+  PangoRectangle    ink;
+  cairo_surface_t  *surface;
+  cairo_t          *cr;
+  Glyph             header;
+  guchar           *block;
+  gsize             size;
+
+  pango_font_get_glyph_extents (font, id, &ink, NULL);
+  pango_extents_to_pixels (&ink, NULL);
+
+  /* One pixel more on every side for the antialiasing */
+  header.x      = ink.x - 1;
+  header.y      = ink.y - 1;
+  header.width  = ink.width + 2;
+  header.height = ink.height + 2;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_A8, header.width, header.height);
+  cr      = cairo_create (surface);
+
+  pango_glyph_string_set_size (string, 1);
+  string->glyphs[0].glyph                 = id;
+  string->glyphs[0].geometry.width        = 0;
+  string->glyphs[0].geometry.x_offset     = 0;
+  string->glyphs[0].geometry.y_offset     = 0;
+  string->glyphs[0].attr.is_cluster_start = 1;
+  string->log_clusters[0]                 = 0;
+
+  cairo_move_to (cr, -header.x, -header.y);
+  pango_cairo_show_glyph_string (cr, font, string);
+  cairo_surface_flush (surface);
+
+  header.stride = cairo_image_surface_get_stride (surface);
+  size          = sizeof (Glyph) + (gsize) header.stride * header.height;
+  block         = g_malloc (size);
+  memcpy (block, &header, sizeof (Glyph));
+  memcpy (block + sizeof (Glyph), cairo_image_surface_get_data (surface),
+          (gsize) header.stride * header.height);
+
+  pango_glyph_string_free (string);
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+
+  return g_bytes_new_take (block, size);
+}
+
+static GBytes *
+lookup_glyph (PangoFont  *font,
+              PangoGlyph  id)
+{
+  PangoFontDescription *desc = pango_font_describe_with_absolute_size (font);
+  gchar                *name = pango_font_description_to_string (desc);
+  gchar                *key  = g_strdup_printf ("%s\n%u", name, id);
+  GBytes               *glyph, *existing;
+
+  pango_font_description_free (desc);
+  g_free (name);
+
+  g_mutex_lock (&glyph_mutex);
+  if (!glyph_cache)
+    glyph_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, (GDestroyNotify) g_bytes_unref);
+  glyph = g_hash_table_lookup (glyph_cache, key);
+  if (glyph)
+    g_bytes_ref (glyph);
+  g_mutex_unlock (&glyph_mutex);
+
+  if (glyph)
+    {
+      g_free (key);
+      return glyph;
+    }
+
+  glyph = render_glyph (font, id);
+
+  g_mutex_lock (&glyph_mutex);
+  existing = g_hash_table_lookup (glyph_cache, key);
+  if (existing)
+    {
+      g_bytes_unref (glyph);
+      glyph = g_bytes_ref (existing);
+      g_free (key);
+    }
+  else
+    {
+      if (g_hash_table_size (glyph_cache) >= GLYPH_CACHE_MAX_ENTRIES)
+        g_hash_table_remove_all (glyph_cache);
+      g_hash_table_insert (glyph_cache, key, g_bytes_ref (glyph));
+    }
+  g_mutex_unlock (&glyph_mutex);
+
+  return glyph;
+}
+
+/* The text layer gegl:text would render, white, put together from cached
+ * glyphs.
+ */
+static GeglBuffer *
+render_text_layer (GeglProperties *o)
+{
+  PangoContext         *context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+  PangoLayout          *layout  = pango_layout_new (context);
+  PangoFontDescription *desc    = pango_font_description_from_string (o->font);
+  PangoLayoutIter      *iter;
+  GArray               *placed  = g_array_new (FALSE, FALSE, sizeof (PlacedGlyph));
+  GeglRectangle         extent  = { 0, 0, 0, 0 };
+  GeglBuffer           *buffer;
+  gfloat               *pixels;
+  guint                 i;
+
+  pango_font_description_set_absolute_size (desc, o->font_size * PANGO_SCALE);
+  pango_layout_set_font_description (layout, desc);
+  pango_layout_set_text (layout, o->text, -1);
+
+  iter = pango_layout_get_iter (layout);
+  do
+    {
+      PangoLayoutRun *run = pango_layout_iter_get_run_readonly (iter);
+      PangoRectangle  logical;
+      gint            x, baseline, g;
+
+      if (!run)
+        continue;
+
+      pango_layout_iter_get_run_extents (iter, NULL, &logical);
+      baseline = pango_layout_iter_get_baseline (iter);
+      x        = logical.x;
+
+      for (g = 0; g < run->glyphs->num_glyphs; g++)
+        {
+          PangoGlyphInfo *info = &run->glyphs->glyphs[g];
+
+          if (info->glyph != PANGO_GLYPH_EMPTY &&
+              !(info->glyph & PANGO_GLYPH_UNKNOWN_FLAG))
+            {
+              PlacedGlyph  place;
+              const Glyph *glyph;
+
+              place.glyph = lookup_glyph (run->item->analysis.font, info->glyph);
+              glyph       = g_bytes_get_data (place.glyph, NULL);
+              place.x     = PANGO_PIXELS (x + info->geometry.x_offset) + glyph->x;
+              place.y     = PANGO_PIXELS (baseline + info->geometry.y_offset) + glyph->y;
+
+              if (placed->len)
+                gegl_rectangle_bounding_box (&extent, &extent,
+                                             GEGL_RECTANGLE (place.x, place.y,
+                                                             glyph->width, glyph->height));
+              else
+                gegl_rectangle_set (&extent, place.x, place.y, glyph->width, glyph->height);
+
+              g_array_append_val (placed, place);
+            }
+          x += info->geometry.width;
+        }
+    }
+  while (pango_layout_iter_next_run (iter));
+  pango_layout_iter_free (iter);
+
+  /* White premultiplied, so every channel is the coverage; glyphs that
+   * overlap are composited over each other like cairo draws them
+   */
+  pixels = g_new0 (gfloat, (gsize) extent.width * extent.height * 4);
+  for (i = 0; i < placed->len; i++)
+    {
+      PlacedGlyph  *place    = &g_array_index (placed, PlacedGlyph, i);
+      const Glyph  *glyph    = g_bytes_get_data (place->glyph, NULL);
+      const guchar *coverage = (const guchar *) (glyph + 1);
+      gint          x, y;
+
+      for (y = 0; y < glyph->height; y++)
+        {
+          gfloat *row = pixels + ((gsize) (place->y - extent.y + y) * extent.width +
+                                  place->x - extent.x) * 4;
+
+          for (x = 0; x < glyph->width; x++)
+            {
+              gfloat c = coverage[y * glyph->stride + x] / 255.0f;
+              gfloat a = row[x * 4 + 3] + c * (1.0f - row[x * 4 + 3]);
+
+              row[x * 4 + 0] = row[x * 4 + 1] = row[x * 4 + 2] = row[x * 4 + 3] = a;
+            }
+        }
+      g_bytes_unref (place->glyph);
+    }
+
+  buffer = gegl_buffer_new (&extent, babl_format ("RaGaBaA float"));
+  gegl_buffer_set (buffer, &extent, 0, babl_format ("RaGaBaA float"), pixels,
+                   GEGL_AUTO_ROWSTRIDE);
+
+  g_free (pixels);
+  g_array_free (placed, TRUE);
+  pango_font_description_free (desc);
+  g_object_unref (layout);
+  g_object_unref (context);
+
+  return buffer;
+}
+#endif
+
+static GeglBuffer *
+render_text_mask (GeglProperties *o)
+{
+  GeglBuffer *buffer = NULL;
+  GeglNode   *graph  = gegl_node_new ();
+  GeglNode   *text, *median, *sink;
+#ifdef HAVE_PANGOCAIRO
+  GeglBuffer *layer  = render_text_layer (o);
+
+  text   = gegl_node_new_child (graph,
+                                "operation", "gegl:buffer-source",
+                                "buffer", layer,
+                                NULL);
+  g_object_unref (layer);
+#else
+  GeglColor  *white  = gegl_color_new ("#ffffff");
+
+  text   = gegl_node_new_child (graph,
+                                "operation", "gegl:text",
+                                "string", o->text,
+                                "font", o->font,
+                                "size", o->font_size,
+                                "color", white,
+                                NULL);
+  g_object_unref (white);
+#endif
+  median = gegl_node_new_child (graph,
+                                "operation", "gegl:median-blur", "abyss-policy", 0,
+                                "radius", o->size,
+                                "alpha-percentile", o->alpha_percentile,
+                                NULL);
+  sink   = gegl_node_new_child (graph,
+                                "operation", "gegl:buffer-sink",
+                                "buffer", &buffer,
+                                NULL);
+
+  gegl_node_link_many (text, median, sink, NULL);
+  gegl_node_process (sink);
+
+  g_object_unref (graph);
+
+  return buffer;
+}
+
+static GeglBuffer *
+lookup_text_mask (GeglProperties *o)
+{
+  GeglBuffer *buffer, *existing;
+  gchar      *key = g_strdup_printf ("%s\n%s\n%.3f\n%d\n%.3f",
+                                     o->text, o->font, o->font_size,
+                                     o->size, o->alpha_percentile);
+
+  g_mutex_lock (&text_mask_mutex);
+  if (!text_mask_cache)
+    text_mask_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, g_object_unref);
+  buffer = g_hash_table_lookup (text_mask_cache, key);
+  if (buffer)
+    g_object_ref (buffer);
+  g_mutex_unlock (&text_mask_mutex);
+
+  if (buffer)
+    {
+      g_free (key);
+      return buffer;
+    }
+
+  /* A whole GEGL graph, rendered without the lock so other workers go on */
+  buffer = render_text_mask (o);
+
+  g_mutex_lock (&text_mask_mutex);
+  existing = g_hash_table_lookup (text_mask_cache, key);
+  if (existing)
+    {
+      g_object_unref (buffer);
+      buffer = g_object_ref (existing);
+      g_free (key);
+    }
+  else
+    {
+      if (g_hash_table_size (text_mask_cache) >= TEXT_MASK_CACHE_MAX_ENTRIES)
+        g_hash_table_remove_all (text_mask_cache);
+      g_hash_table_insert (text_mask_cache, key, g_object_ref (buffer));
+    }
+  g_mutex_unlock (&text_mask_mutex);
+
+  return buffer;
+}
+
 
 static void attach (GeglOperation *operation)
 {
@@ -374,10 +803,127 @@ static void attach (GeglOperation *operation)
                                   "operation", "gegl:color-overlay",
                                   NULL);
 
+    state->textmask    = gegl_node_new_child (gegl,
+                                  "operation", "gegl:buffer-source",
+                                  NULL);
+
+/*
+The color overlay and the first median blur do not depend on seed or seed2. This cache keeps their
+result when only the seeds change, so rendering many seed variants on one graph only runs the seeded tail again.
+ */
+    state->prefix    = gegl_node_new_child (gegl,
+                                  "operation", "gegl:cache",
+                                  NULL);
+
+/*
+Everything up to the second median only depends on the text and the rockification settings. This cache keeps
+the rock shape when only the lighting, colors or finish change, like in the frames of an animated light.
+ */
+    state->shape    = gegl_node_new_child (gegl,
+                                  "operation", "gegl:cache",
+                                  NULL);
+    state->linked   = -1;
+
+/*
+Reduced resolution rock shape, see the resolution property. front is where the shape chain starts, down scales
+it down and up scales the finished shape back to full size. lb:rock-upsample follows the edges of front while it
+does that; without it rock text falls back to a plain linear scale.
+ */
+    state->front    = gegl_node_new_child (gegl,
+                                  "operation", "gegl:nop",
+                                  NULL);
+
+    state->down    = gegl_node_new_child (gegl,
+                                  "operation", "gegl:scale-ratio", "sampler", GEGL_SAMPLER_LINEAR,
+                                  NULL);
+
+  if (gegl_has_operation ("lb:rock-upsample"))
+    state->up    = gegl_node_new_child (gegl,
+                                  "operation", "lb:rock-upsample",
+                                  NULL);
+  else
+    state->up    = gegl_node_new_child (gegl,
+                                  "operation", "gegl:scale-ratio", "sampler", GEGL_SAMPLER_LINEAR,
+                                  NULL);
+
+/*
+lb:rock-spread is noise spread with its random offsets cached for every seed and amount, see the noise-cache
+property.
+ */
+  if (gegl_has_operation ("lb:rock-spread"))
+    state->spread    = gegl_node_new_child (gegl,
+                                  "operation", "lb:rock-spread",
+                                  NULL);
+
+/*
+Draft quality stand ins, see the quality property
+ */
+    state->boxblur    = gegl_node_new_child (gegl,
+                                  "operation", "gegl:box-blur", "abyss-policy", 0,
+                                  NULL);
+
+/*
+lb:rock-median is a quicker percentile filter for small radii on 8 bit histograms. Below final quality it stands
+in for the two medians and the draft edge smoothing; without it rock text keeps gegl:median-blur everywhere.
+ */
+  if (gegl_has_operation ("lb:rock-median"))
+    {
+    state->fastmedian    = gegl_node_new_child (gegl,
+                                  "operation", "lb:rock-median",
+                                  NULL);
+
+    state->fastmedian2    = gegl_node_new_child (gegl,
+                                  "operation", "lb:rock-median",
+                                  NULL);
+
+    state->draftsmooth    = gegl_node_new_child (gegl,
+                                  "operation", "lb:rock-median", "radius", 1,
+                                  NULL);
+    }
+  else
+    state->draftsmooth    = gegl_node_new_child (gegl,
+                                  "operation", "gegl:median-blur", "abyss-policy", 0, "radius", 1,
+                                  NULL);
+
+/*
+lb:rock-outline draws the same outline as gegl:dropshadow and takes the same properties, but only works
+on alpha and composites in the same pass. Without it rock text uses gegl:dropshadow.
+ */
+  if (gegl_has_operation ("lb:rock-outline"))
+      state->outline    = gegl_node_new_child (gegl,
+                                  "operation", "lb:rock-outline",
+                                  NULL);
+  else
       state->outline    = gegl_node_new_child (gegl,
                                   "operation", "gegl:dropshadow",
                                   NULL);
 
+/*
+lb:rock-colorize does threshold alpha, the image overlay multiply and the color multiply in one pass.
+It is a separate plugin, without it rock text keeps using the separate nodes.
+ */
+  if (gegl_has_operation ("lb:rock-colorize"))
+     state->colorize    = gegl_node_new_child (gegl,
+                                  "operation", "lb:rock-colorize",
+                                  NULL);
+
+/*
+lb:rock-bevel is the distance field bevel engine, an alternative to emboss.
+ */
+  if (gegl_has_operation ("lb:rock-bevel"))
+     state->bevel    = gegl_node_new_child (gegl,
+                                  "operation", "lb:rock-bevel",
+                                  NULL);
+
+/*
+lb:rock-finish does the grain over, mean curvature blur and exposure in one pass over one padded tile. Below final
+quality it also does the edge smoothing, with the settings of the edgesmooth node above.
+ */
+  if (gegl_has_operation ("lb:rock-finish"))
+     state->finish    = gegl_node_new_child (gegl,
+                                  "operation", "lb:rock-finish", "alpha-percentile2", 67.0, "gaus", 0.75,  "value", 2.2,
+                                  NULL);
+
 
   gegl_operation_meta_redirect (operation, "size", state->median, "radius");
   gegl_operation_meta_redirect (operation, "shift", state->shift, "shift");
@@ -402,40 +948,447 @@ static void attach (GeglOperation *operation)
   gegl_operation_meta_redirect (operation, "mvalue", state->coloroverlay, "value");
   gegl_operation_meta_redirect (operation, "src", state->imagefileupload, "src");
   gegl_operation_meta_redirect (operation, "grains", state->opacity, "value");
+  if (state->colorize)
+    gegl_operation_meta_redirect (operation, "mvalue", state->colorize, "color");
+  if (state->finish)
+    gegl_operation_meta_redirect (operation, "exposure", state->finish, "exposure");
+  if (state->bevel)
+    {
+  gegl_operation_meta_redirect (operation, "azimuth", state->bevel, "azimuth");
+  gegl_operation_meta_redirect (operation, "elevation", state->bevel, "elevation");
+  gegl_operation_meta_redirect (operation, "depth", state->bevel, "depth");
+  gegl_operation_meta_redirect (operation, "bevel-width", state->bevel, "width");
+    }
 
 
 }
 
 
+/* The bounding box of the pixels where two masks differ, FALSE when they
+ * are the same. Pixels outside a buffer count as clear.
+ */
+static gboolean
+mask_difference (GeglBuffer    *a,
+                 GeglBuffer    *b,
+                 GeglRectangle *dirty)
+{
+  const Babl   *format = gegl_buffer_get_format (b);
+  gint          bpp    = babl_format_get_bytes_per_pixel (format);
+  GeglRectangle all;
+  guchar       *row_a, *row_b;
+  gint          x0 = G_MAXINT, x1 = G_MININT, y0 = G_MAXINT, y1 = G_MININT;
+  gint          x, y;
+
+  gegl_rectangle_bounding_box (&all, gegl_buffer_get_extent (a), gegl_buffer_get_extent (b));
+  row_a = g_malloc (all.width * bpp);
+  row_b = g_malloc (all.width * bpp);
+
+  for (y = all.y; y < all.y + all.height; y++)
+    {
+      GeglRectangle row = { all.x, y, all.width, 1 };
+
+      gegl_buffer_get (a, &row, 1.0, format, row_a, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+      gegl_buffer_get (b, &row, 1.0, format, row_b, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+      if (!memcmp (row_a, row_b, all.width * bpp))
+        continue;
+
+      for (x = 0; x < all.width; x++)
+        if (memcmp (row_a + x * bpp, row_b + x * bpp, bpp))
+          {
+            x0 = MIN (x0, all.x + x);
+            x1 = MAX (x1, all.x + x);
+          }
+      y0 = MIN (y0, y);
+      y1 = MAX (y1, y);
+    }
+
+  g_free (row_a);
+  g_free (row_b);
+
+  if (y0 > y1)
+    return FALSE;
+
+  dirty->x      = x0;
+  dirty->y      = y0;
+  dirty->width  = x1 - x0 + 1;
+  dirty->height = y1 - y0 + 1;
+  return TRUE;
+}
+
+/* update_graph runs after every property change, so only touch the mask
+ * when another one comes in. The node keeps a copy of its own and only the
+ * rectangle where the new mask differs is copied over; the copy reports
+ * just that rectangle as changed, gegl:buffer-source invalidates only
+ * there, and editing one word of the text reruns rock text around that word
+ * instead of over the whole layer.
+ */
+static void
+set_text_mask (State      *state,
+               GeglBuffer *mask)
+{
+  GeglBuffer   *current = NULL;
+  GeglRectangle dirty;
+
+  if (mask == state->mask_from)
+    return;
+
+  gegl_node_get (state->textmask, "buffer", &current, NULL);
+
+  if (mask && current)
+    {
+      if (mask_difference (current, mask, &dirty))
+        {
+          gegl_buffer_set_extent (current, gegl_buffer_get_extent (mask));
+          gegl_buffer_copy (mask, &dirty, GEGL_ABYSS_NONE, current, &dirty);
+        }
+    }
+  else
+    {
+      GeglBuffer *copy = mask ? gegl_buffer_dup (mask) : NULL;
+
+      gegl_node_set (state->textmask, "buffer", copy, NULL);
+      g_clear_object (&copy);
+    }
+
+  g_clear_object (&current);
+  g_clear_object (&state->mask_from);
+  state->mask_from = mask ? g_object_ref (mask) : NULL;
+}
+
+/* The fused colorize node multiplies by mvalue before the outline instead of after it. Tinting the outline
+ * color with mvalue too gives the same pixels, as long as mvalue is opaque.
+ */
+static gboolean
+use_colorize (State          *state,
+              GeglProperties *o)
+{
+  gdouble r, g, b, a;
+
+  if (!state->colorize)
+    return FALSE;
+
+  gegl_color_get_rgba (o->mvalue, &r, &g, &b, &a);
+  return a == 1.0;
+}
+
+static gboolean
+use_fast_median (State          *state,
+                 GeglProperties *o)
+{
+  return state->fastmedian && o->quality != ROCKTEXT_QUALITY_FINAL;
+}
+
+/* lb:rock-finish's edge smoothing uses 8 bit medians like lb:rock-median */
+static gboolean
+use_fused_edges (State          *state,
+                 GeglProperties *o)
+{
+  return state->finish && o->quality == ROCKTEXT_QUALITY_NORMAL;
+}
+
+static void
+set_outline_color (State          *state,
+                   GeglProperties *o,
+                   gboolean        tinted)
+{
+  GeglColor *current = NULL;
+  gdouble    r, g, b, a, mr, mg, mb, ma, cr, cg, cb, ca;
+
+  gegl_color_get_rgba (o->color, &r, &g, &b, &a);
+  if (tinted)
+    {
+      gegl_color_get_rgba (o->mvalue, &mr, &mg, &mb, &ma);
+      r *= mr;
+      g *= mg;
+      b *= mb;
+    }
+
+  gegl_node_get (state->outline, "color", &current, NULL);
+  gegl_color_get_rgba (current, &cr, &cg, &cb, &ca);
+  if (cr != r || cg != g || cb != b || ca != a)
+    {
+      GeglColor *wanted = gegl_color_new (NULL);
+      gegl_color_set_rgba (wanted, r, g, b, a);
+      gegl_node_set (state->outline, "color", wanted, NULL);
+      g_object_unref (wanted);
+    }
+  g_object_unref (current);
+}
+
+static gint
+resolution_factor (GeglProperties *o)
+{
+  switch (o->resolution)
+    {
+    case ROCKTEXT_RESOLUTION_HALF:    return 2;
+    case ROCKTEXT_RESOLUTION_QUARTER: return 4;
+    default:                          return 1;
+    }
+}
+
+/* Setting a property invalidates the node even when the value stays, so only set it when it changes */
+static void
+set_int_property (GeglNode    *node,
+                  const gchar *name,
+                  gint         value)
+{
+  gint current = 0;
+
+  gegl_node_get (node, name, &current, NULL);
+  if (current != value)
+    gegl_node_set (node, name, value, NULL);
+}
+
+static void
+set_double_property (GeglNode    *node,
+                     const gchar *name,
+                     gdouble      value)
+{
+  gdouble current = 0.0;
+
+  gegl_node_get (node, name, &current, NULL);
+  if (current != value)
+    gegl_node_set (node, name, value, NULL);
+}
+
+/* Every choice the linking in update_graph makes, one bit each. A new
+ * choice there gets its bit here, or switching it would not relink.
+ */
+enum
+{
+  LINK_COLORIZE         = 1 << 0,
+  LINK_HARDLIGHT        = 1 << 1,
+  LINK_DONT_CACHE       = 1 << 2,
+  LINK_DISTANCE_BEVEL   = 1 << 3,
+  LINK_DRAFT            = 1 << 4,
+  LINK_RESOLUTION_SHIFT = 5,        /* resolution_factor, 1, 2 or 4 */
+  LINK_FAST_MEDIAN      = 1 << 8,
+  LINK_SPREAD           = 1 << 9,
+  LINK_FUSED_EDGES      = 1 << 10,
+};
+
+static gint
+link_key (State          *state,
+          GeglProperties *o,
+          gboolean        dont_cache)
+{
+  return (use_colorize (state, o)                             ? LINK_COLORIZE       : 0) |
+         (o->rockblend == hardlight                           ? LINK_HARDLIGHT      : 0) |
+         (dont_cache                                          ? LINK_DONT_CACHE     : 0) |
+         (o->bevel == ROCKTEXT_BEVEL_DISTANCE && state->bevel ? LINK_DISTANCE_BEVEL : 0) |
+         (o->quality == ROCKTEXT_QUALITY_DRAFT                ? LINK_DRAFT          : 0) |
+         (resolution_factor (o) << LINK_RESOLUTION_SHIFT) |
+         (use_fast_median (state, o)                          ? LINK_FAST_MEDIAN    : 0) |
+         (o->noise_cache && state->spread                     ? LINK_SPREAD         : 0) |
+         (use_fused_edges (state, o)                          ? LINK_FUSED_EDGES    : 0);
+}
+
 static void
 update_graph (GeglOperation *operation)
 {
   GeglProperties *o = GEGL_PROPERTIES (operation);
   State *state = o->user_data;
+  gboolean dont_cache = FALSE;
+  gboolean fast;
+  GeglNode *median, *median2, *noise;
+  gint     linked;
   if (!state) return;
 
+  fast    = use_fast_median (state, o);
+  median  = fast ? state->fastmedian  : state->median;
+  median2 = fast ? state->fastmedian2 : state->median2;
+  noise   = o->noise_cache && state->spread ? state->spread : state->noise;
+
+  /* A rock text node that must not cache, like in a streaming render, skips the prefix and shape caches too */
+  g_object_get (operation->node, "dont-cache", &dont_cache, NULL);
+
+  if (o->text && o->text[0])
+    {
+      GeglBuffer *mask = lookup_text_mask (o);
+      set_text_mask (state, mask);
+      g_object_unref (mask);
+      if (gegl_node_get_producer (state->front, "input", NULL) != state->textmask)
+        gegl_node_link_many (state->textmask, state->front, NULL);
+    }
+  else
+    {
+      set_text_mask (state, NULL);
+
+      /* The redirects only reach gegl:median-blur */
+      if (fast)
+        {
+          set_int_property (median, "radius", o->size);
+          set_double_property (median, "alpha-percentile", o->alpha_percentile);
+        }
+
+      /* Relinking would invalidate the prefix cache, so only do it when switching modes */
+      if (dont_cache)
+        {
+          if (gegl_node_get_producer (state->front, "input", NULL) != median)
+            gegl_node_link_many (state->input, state->color, median, state->front, NULL);
+        }
+      else if (gegl_node_get_producer (state->front, "input", NULL) != state->prefix ||
+               gegl_node_get_producer (state->prefix, "input", NULL) != median)
+        gegl_node_link_many (state->input, state->color, median, state->prefix, state->front, NULL);
+    }
+
+/*
+At half or quarter resolution the distances of the shape chain shrink with it. The redirects copy the full size
+values, this puts the scaled ones over them; at full size they are the same values and nothing is set.
+ */
+  {
+    gint f = resolution_factor (o);
+
+    set_int_property (noise,          "amount-x", (o->amountx + f / 2) / f);
+    set_int_property (noise,          "amount-y", (o->amounty + f / 2) / f);
+    if (noise == state->spread)
+      set_int_property (noise,        "seed",     o->seed);
+    set_int_property (state->shift,   "shift",    (o->shift + f / 2) / f);
+    set_int_property (median2,        "radius",   (o->size2 + f / 2) / f);
+    set_double_property (state->gaussian, "std-dev-x", o->gaussian / f);
+    set_double_property (state->gaussian, "std-dev-y", o->gaussian / f);
+
+    if (f > 1)
+      {
+        set_double_property (state->down, "x", 1.0 / f);
+        set_double_property (state->down, "y", 1.0 / f);
+        if (!strcmp (gegl_node_get_operation (state->up), "lb:rock-upsample"))
+          set_int_property (state->up, "scale", f);
+        else
+          {
+            set_double_property (state->up, "x", (gdouble) f);
+            set_double_property (state->up, "y", (gdouble) f);
+          }
+      }
+  }
+
+/*
+noise-spread, shift and noise-hsv already draw their noise from GeglRandom, which hashes the absolute pixel
+coordinates, and the medians, emboss and mean curvature blur only read a fixed neighborhood. The one exception is
+the gaussian; above a std-dev of 1.0 its auto filter becomes IIR, which runs over whole rows and columns of its input.
+That gives the same pixels however the image is split, but a band or shard then reads whole columns. Forcing FIR
+(1) keeps its reach fixed too; 0 is auto, which is already the cheaper filter for each std-dev.
+ */
+  {
+    gint filter = 0;
+    gint wanted = o->bounded_reach ? 1 : 0;
+    gegl_node_get (state->gaussian, "filter", &filter, NULL);
+    if (filter != wanted)
+      gegl_node_set (state->gaussian, "filter", wanted, NULL);
+  }
+
+/*
+A box of radius r has the variance r (r + 1) / 3 of a gaussian, pick the r that comes closest to the std-dev
+ */
+  if (o->quality == ROCKTEXT_QUALITY_DRAFT)
+    {
+      gint radius = 0;
+      gdouble sigma  = o->gaussian / resolution_factor (o);
+      gint    wanted = MAX (1, (gint) floor ((sqrt (1.0 + 12.0 * sigma * sigma) - 1.0) / 2.0 + 0.5));
+      gegl_node_get (state->boxblur, "radius", &radius, NULL);
+      if (radius != wanted)
+        gegl_node_set (state->boxblur, "radius", wanted, NULL);
+    }
+
+  GeglNode *blend = state->multiply;
+  gboolean  fused;
+
 switch (o->rockblend) {
         break;
     case multiply:
-  gegl_node_link_many (state->input, state->color, state->median, state->noise, state->gaussian, state->shift, state->median2, state->idref, state->multiply, state->alpha, state->image, state->outline, state->nop, state->mcol,  state->nop2, state->normal, state->smooth,  state->exposure, state->edgesmooth, state->output, NULL);
-  gegl_node_connect (state->image, "aux", state->imagefileupload, "output");
-  gegl_node_connect (state->mcol, "aux", state->coloroverlay, "output");
-  gegl_node_connect (state->normal, "aux", state->opacity, "output");
-  gegl_node_link_many (state->nop2, state->graph, state->opacity, NULL);
-  gegl_node_link_many (state->nop, state->coloroverlay, NULL);
-  gegl_node_connect (state->multiply, "aux", state->emboss, "output");
-  gegl_node_link_many (state->idref, state->emboss, NULL);
+  blend = state->multiply;
         break;
     case hardlight:
-  gegl_node_link_many (state->input, state->color, state->median, state->noise, state->gaussian, state->shift, state->median2, state->idref, state->hardlight, state->alpha, state->image, state->outline, state->nop, state->mcol,  state->nop2, state->normal, state->smooth,  state->exposure, state->edgesmooth, state->output, NULL);
+  blend = state->hardlight;
+        break;
+    }
+
+  fused = use_colorize (state, o);
+  set_outline_color (state, o, fused);
+  if (state->finish)
+    set_int_property (state->finish, "edgesmooth", use_fused_edges (state, o));
+  if (state->bevel)
+    {
+      gint profile = 0;
+      gegl_node_get (state->bevel, "profile", &profile, NULL);
+      if (profile != (gint) o->bevel_profile)
+        gegl_node_set (state->bevel, "profile", (gint) o->bevel_profile, NULL);
+    }
+
+/*
+Relinking a node throws away the caches of everything after it, so the tail is only linked again when its shape
+changes. Properties that only go to one node keep the rest of the chain cached.
+ */
+  linked = link_key (state, o, dont_cache);
+  if (linked == state->linked)
+    return;
+  state->linked = linked;
+
+  {
+  GeglNode *blur = o->quality == ROCKTEXT_QUALITY_DRAFT ? state->boxblur : state->gaussian;
+  GeglNode *last = median2;
+
+  if (resolution_factor (o) > 1)
+    {
+  gegl_node_link_many (state->front, state->down, noise, NULL);
+  gegl_node_link_many (median2, state->up, NULL);
+  if (!strcmp (gegl_node_get_operation (state->up), "lb:rock-upsample"))
+  gegl_node_connect (state->up, "aux", state->front, "output");
+  last = state->up;
+    }
+  else
+  gegl_node_link_many (state->front, noise, NULL);
+
+  gegl_node_link_many (noise, blur, state->shift, median2, NULL);
+  if (dont_cache)
+  gegl_node_link_many (last, state->idref, NULL);
+  else
+  gegl_node_link_many (last, state->shape, state->idref, NULL);
+  }
+
+  if (fused)
+    {
+  gegl_node_link_many (state->idref, blend, state->colorize, state->outline, state->nop2, NULL);
+  gegl_node_connect (state->colorize, "aux", state->imagefileupload, "output");
+    }
+  else
+    {
+  gegl_node_link_many (state->idref, blend, state->alpha, state->image, state->outline, state->nop, state->mcol,  state->nop2, NULL);
   gegl_node_connect (state->image, "aux", state->imagefileupload, "output");
   gegl_node_connect (state->mcol, "aux", state->coloroverlay, "output");
+  gegl_node_link_many (state->nop, state->coloroverlay, NULL);
+    }
+
+  /* Draft skips the grain and the mean curvature blur, exposure stays */
+  if (o->quality == ROCKTEXT_QUALITY_DRAFT)
+    {
+  gegl_node_link_many (state->nop2, state->exposure, state->draftsmooth, state->output, NULL);
+    }
+  else if (use_fused_edges (state, o))
+    {
+  gegl_node_link_many (state->nop2, state->finish, state->output, NULL);
+  gegl_node_connect (state->finish, "aux", state->opacity, "output");
+    }
+  else if (state->finish)
+    {
+  gegl_node_link_many (state->nop2, state->finish, state->edgesmooth, state->output, NULL);
+  gegl_node_connect (state->finish, "aux", state->opacity, "output");
+    }
+  else
+    {
+  gegl_node_link_many (state->nop2, state->normal, state->smooth,  state->exposure, state->edgesmooth, state->output, NULL);
   gegl_node_connect (state->normal, "aux", state->opacity, "output");
+    }
   gegl_node_link_many (state->nop2, state->graph, state->opacity, NULL);
-  gegl_node_link_many (state->nop, state->coloroverlay, NULL);
-  gegl_node_connect (state->hardlight, "aux", state->emboss, "output");
+  if (o->bevel == ROCKTEXT_BEVEL_DISTANCE && state->bevel)
+    {
+  gegl_node_connect (blend, "aux", state->bevel, "output");
+  gegl_node_link_many (state->idref, state->bevel, NULL);
+    }
+  else
+    {
+  gegl_node_connect (blend, "aux", state->emboss, "output");
   gegl_node_link_many (state->idref, state->emboss, NULL);
-        break;
     }
   }
 
@@ -0,0 +1,362 @@
+/* This file is an image processing operation for GEGL
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Internal part of Rock Text. Joint bilateral upsampling: the input is the rock heightfield computed at 1/scale
+of the size, aux is the full size layer it was made from. Every output pixel mixes the 4x4 small pixels around
+it, weighted by distance and by how close the alpha of aux at the small pixel is to the alpha of aux at the
+output pixel, so the upsampled rock follows the full resolution edges of the text instead of blurring over them.
+ */
+
+#include "config.h"
+#include <glib/gi18n-lib.h>
+
+#ifdef GEGL_PROPERTIES
+
+property_int (scale, _("Scale"), 2)
+  description (_("How many times smaller the input is than aux"))
+  value_range (1, 8)
+
+property_double (range, _("Edge sensitivity"), 0.1)
+  description (_("Difference of the guideꞌs alpha at which a sample counts for about 60%, smaller values keep edges sharper"))
+  value_range (0.01, 1.0)
+
+#else
+
+#define GEGL_OP_COMPOSER
+#define GEGL_OP_NAME     rock_upsample
+#define GEGL_OP_C_SOURCE rock-upsample.c
+
+#include "gegl-op.h"
+#include "rock-arena.h"
+#include "rock-format.h"
+#include "rock-dispatch.h"
+
+#define TAPS      4
+#define RANGE_LUT 256
+
+static gint
+floor_div (gint a,
+           gint b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/* The small pixels the 4x4 taps of roi read */
+static GeglRectangle
+small_rect (gint                 scale,
+            const GeglRectangle *roi)
+{
+  GeglRectangle rect;
+
+  rect.x      = floor_div (roi->x, scale) - 2;
+  rect.y      = floor_div (roi->y, scale) - 2;
+  rect.width  = floor_div (roi->x + roi->width - 1, scale) + 3 - rect.x;
+  rect.height = floor_div (roi->y + roi->height - 1, scale) + 3 - rect.y;
+
+  return rect;
+}
+
+static GeglRectangle
+scale_rect (const GeglRectangle *rect,
+            gint                 scale)
+{
+  GeglRectangle scaled = { rect->x * scale, rect->y * scale,
+                           rect->width * scale, rect->height * scale };
+  return scaled;
+}
+
+static void
+prepare (GeglOperation *operation)
+{
+  const Babl *space  = gegl_operation_get_source_space (operation, "input");
+  const Babl *format = rock_format_negotiate (operation, "input", "RaGaBaA float", NULL);
+
+  gegl_operation_set_format (operation, "input",  format);
+  gegl_operation_set_format (operation, "aux",    babl_format_with_space ("RGBA float", space));
+  gegl_operation_set_format (operation, "output", format);
+}
+
+static GeglRectangle
+get_bounding_box (GeglOperation *operation)
+{
+  GeglProperties *o        = GEGL_PROPERTIES (operation);
+  GeglRectangle  *in_rect  = gegl_operation_source_get_bounding_box (operation, "input");
+  GeglRectangle  *aux_rect = gegl_operation_source_get_bounding_box (operation, "aux");
+  GeglRectangle   rect     = { 0, 0, 0, 0 };
+
+  /* The scaled up shape can reach past the guide, and the guide past it */
+  if (in_rect)
+    rect = scale_rect (in_rect, o->scale);
+  if (aux_rect)
+    gegl_rectangle_bounding_box (&rect, &rect, aux_rect);
+
+  return rect;
+}
+
+static GeglRectangle
+get_required_for_output (GeglOperation       *operation,
+                         const gchar         *input_pad,
+                         const GeglRectangle *roi)
+{
+  GeglProperties *o     = GEGL_PROPERTIES (operation);
+  GeglRectangle   small = small_rect (o->scale, roi);
+  GeglRectangle   guide;
+
+  /* The guide is read at the output pixels and at the centers of the small
+   * pixels around them
+   */
+  if (!strcmp (input_pad, "aux"))
+    {
+      guide = scale_rect (&small, o->scale);
+      gegl_rectangle_bounding_box (&guide, &guide, roi);
+      return guide;
+    }
+
+  return small;
+}
+
+static GeglRectangle
+get_invalidated_by_change (GeglOperation       *operation,
+                           const gchar         *input_pad,
+                           const GeglRectangle *input_region)
+{
+  GeglProperties *o      = GEGL_PROPERTIES (operation);
+  GeglRectangle   result = *input_region;
+
+  if (strcmp (input_pad, "aux"))
+    result = scale_rect (input_region, o->scale);
+
+  result.x      -= 2 * o->scale;
+  result.y      -= 2 * o->scale;
+  result.width  += 4 * o->scale;
+  result.height += 4 * o->scale;
+
+  return result;
+}
+
+/* Upsamples small (small_w wide) into out, width x height. ix and iy hold
+ * the first tap of every column and row, wx and wy their TAPS spatial
+ * weights. guide is the full size alpha at the output pixels (guide_w
+ * wide, NULL without aux), guide_small the alpha at the centers of the
+ * small pixels.
+ */
+ROCK_KERNEL static void
+upsample (const gfloat *small,
+          gint          small_w,
+          const gfloat *guide,
+          gint          guide_w,
+          const gfloat *guide_small,
+          const gint   *ix,
+          const gint   *iy,
+          const gfloat *wx,
+          const gfloat *wy,
+          const gfloat *lut,
+          gfloat       *out,
+          gint          width,
+          gint          height)
+{
+  gint x, y, i, j, c;
+
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      {
+        gfloat sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        gfloat total  = 0.0f;
+        gfloat center = guide ? guide[y * guide_w + x] : 0.0f;
+
+        for (j = 0; j < TAPS; j++)
+          for (i = 0; i < TAPS; i++)
+            {
+              gint          q = (iy[y] + j) * small_w + ix[x] + i;
+              const gfloat *s = small + q * 4;
+              gfloat        w = wx[x * TAPS + i] * wy[y * TAPS + j];
+
+              if (guide)
+                w *= lut[(gint) (MIN (fabsf (guide_small[q] - center), 1.0f) * (RANGE_LUT - 1) + 0.5f)];
+
+              for (c = 0; c < 4; c++)
+                sum[c] += s[c] * w;
+              total += w;
+            }
+
+        /* The guide sits between samples that all disagree with it, fall
+         * back to the spatial weights alone
+         */
+        if (total < 1e-6f)
+          {
+            total = 0.0f;
+            sum[0] = sum[1] = sum[2] = sum[3] = 0.0f;
+
+            for (j = 0; j < TAPS; j++)
+              for (i = 0; i < TAPS; i++)
+                {
+                  const gfloat *s = small + ((iy[y] + j) * small_w + ix[x] + i) * 4;
+                  gfloat        w = wx[x * TAPS + i] * wy[y * TAPS + j];
+
+                  for (c = 0; c < 4; c++)
+                    sum[c] += s[c] * w;
+                  total += w;
+                }
+          }
+
+        for (c = 0; c < 4; c++)
+          out[(y * width + x) * 4 + c] = sum[c] / total;
+      }
+}
+
+/* First tap and the TAPS gaussian weights (std-dev of one small pixel) of
+ * the n output pixels from start on.
+ */
+static void
+spatial_weights (gint    start,
+                 gint    n,
+                 gint    scale,
+                 gint    small_start,
+                 gint   *first,
+                 gfloat *weights)
+{
+  gint p, t;
+
+  for (p = 0; p < n; p++)
+    {
+      gdouble u  = (start + p + 0.5) / scale - 0.5;
+      gint    i0 = (gint) floor (u) - 1;
+
+      first[p] = i0 - small_start;
+      for (t = 0; t < TAPS; t++)
+        {
+          gdouble d = u - (i0 + t);
+          weights[p * TAPS + t] = expf (-0.5f * (gfloat) (d * d));
+        }
+    }
+}
+
+static gboolean
+process (GeglOperation       *operation,
+         GeglBuffer          *input,
+         GeglBuffer          *aux,
+         GeglBuffer          *output,
+         const GeglRectangle *result,
+         gint                 level)
+{
+  GeglProperties *o       = GEGL_PROPERTIES (operation);
+  const Babl     *format  = gegl_operation_get_format (operation, "output");
+  const Babl     *gformat = gegl_operation_get_format (operation, "aux");
+  gint            f       = o->scale;
+  GeglRectangle   s_rect  = small_rect (f, result);
+  GeglRectangle   g_rect  = scale_rect (&s_rect, f);
+  gint            s_n     = s_rect.width * s_rect.height;
+  gint            g_n     = g_rect.width * g_rect.height;
+  gint            n       = result->width * result->height;
+  RockArena      *arena;
+  gfloat         *small, *out, *wx, *wy, *lut;
+  gfloat         *guide = NULL, *guide_small = NULL;
+  gint           *ix, *iy;
+  gint            i, x, y;
+
+  arena = rock_arena_begin (ROCK_ARENA_SIZE (sizeof (gfloat) * s_n * 4) +
+                            ROCK_ARENA_SIZE (sizeof (gfloat) * n * 4) +
+                            ROCK_ARENA_SIZE (sizeof (gfloat) * result->width * TAPS) +
+                            ROCK_ARENA_SIZE (sizeof (gfloat) * result->height * TAPS) +
+                            ROCK_ARENA_SIZE (sizeof (gint) * result->width) +
+                            ROCK_ARENA_SIZE (sizeof (gint) * result->height) +
+                            ROCK_ARENA_SIZE (sizeof (gfloat) * RANGE_LUT) +
+                            (aux ? ROCK_ARENA_SIZE (sizeof (gfloat) * g_n * 4) +
+                                   ROCK_ARENA_SIZE (sizeof (gfloat) * s_n) : 0));
+  small = rock_arena_alloc (arena, sizeof (gfloat) * s_n * 4);
+  out   = rock_arena_alloc (arena, sizeof (gfloat) * n * 4);
+  wx    = rock_arena_alloc (arena, sizeof (gfloat) * result->width * TAPS);
+  wy    = rock_arena_alloc (arena, sizeof (gfloat) * result->height * TAPS);
+  ix    = rock_arena_alloc (arena, sizeof (gint) * result->width);
+  iy    = rock_arena_alloc (arena, sizeof (gint) * result->height);
+  lut   = rock_arena_alloc (arena, sizeof (gfloat) * RANGE_LUT);
+
+  gegl_buffer_get (input, &s_rect, 1.0, format, small,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_CLAMP);
+
+  spatial_weights (result->x, result->width,  f, s_rect.x, ix, wx);
+  spatial_weights (result->y, result->height, f, s_rect.y, iy, wy);
+
+  for (i = 0; i < RANGE_LUT; i++)
+    {
+      gfloat d = (gfloat) i / (RANGE_LUT - 1) / o->range;
+      lut[i] = expf (-0.5f * d * d);
+    }
+
+  if (aux)
+    {
+      gfloat *rgba = rock_arena_alloc (arena, sizeof (gfloat) * g_n * 4);
+      gint    ox   = result->x - g_rect.x;
+      gint    oy   = result->y - g_rect.y;
+
+      gegl_buffer_get (aux, &g_rect, 1.0, gformat, rgba,
+                       GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_CLAMP);
+
+      /* Alpha at the center of every small pixel, then alpha of the
+       * output pixels packed in place at the start of rgba
+       */
+      guide_small = rock_arena_alloc (arena, sizeof (gfloat) * s_n);
+      for (y = 0; y < s_rect.height; y++)
+        for (x = 0; x < s_rect.width; x++)
+          guide_small[y * s_rect.width + x] =
+            rgba[((y * f + f / 2) * g_rect.width + x * f + f / 2) * 4 + 3];
+
+      guide = rgba;
+      for (y = 0; y < result->height; y++)
+        for (x = 0; x < result->width; x++)
+          guide[y * result->width + x] = rgba[((y + oy) * g_rect.width + x + ox) * 4 + 3];
+    }
+
+  upsample (small, s_rect.width, guide, result->width, guide_small,
+            ix, iy, wx, wy, lut, out, result->width, result->height);
+
+  gegl_buffer_set (output, result, 0, format, out, GEGL_AUTO_ROWSTRIDE);
+
+  rock_arena_end (arena);
+
+  return TRUE;
+}
+
+static void
+gegl_op_class_init (GeglOpClass *klass)
+{
+  GeglOperationClass         *operation_class;
+  GeglOperationComposerClass *composer_class;
+
+  operation_class = GEGL_OPERATION_CLASS (klass);
+  composer_class  = GEGL_OPERATION_COMPOSER_CLASS (klass);
+
+  operation_class->prepare                   = prepare;
+  operation_class->get_bounding_box          = get_bounding_box;
+  operation_class->get_required_for_output   = get_required_for_output;
+  operation_class->get_invalidated_by_change = get_invalidated_by_change;
+  operation_class->threaded                  = TRUE;
+  composer_class->process                    = process;
+
+  gegl_operation_class_set_keys (operation_class,
+    "name",        "lb:rock-upsample",
+    "title",       _("Rock Text upsample"),
+    "categories",  "hidden",
+    "reference-hash", "c41d9e2a7b6f05e83d1cb2ac",
+    "description", _("Joint bilateral upsampling of a small heightfield, guided by the alpha of the full size layer. Used inside Rock Text"),
+    NULL);
+}
+
+#endif
@@ -0,0 +1,4 @@
+#!/bin/bash
+
+
+meson setup --buildtype=release build && ninja -C build
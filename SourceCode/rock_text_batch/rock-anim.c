@@ -0,0 +1,228 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Animations. The frames of one entry go through one graph in order (see push_jobs in rock-text-batch.c) and
+only the properties that moved are set again, so rock text recomputes from the first stage that changed and
+the caches in front of it (the text mask, the prefix and the shape cache) carry over from frame to frame.
+Finished frames are handed to a writer pool so encoding overlaps with rendering the next frame.
+ */
+
+#include <string.h>
+#include <glib/gstdio.h>
+#include "rock-job.h"
+
+/* Properties not listed here are treated as the text stage, which is always safe */
+static const struct
+{
+  const gchar *name;
+  RockStage    stage;
+} rock_stages[] =
+{
+  { "text",             ROCK_STAGE_TEXT   },
+  { "font",             ROCK_STAGE_TEXT   },
+  { "font-size",        ROCK_STAGE_TEXT   },
+  { "size",             ROCK_STAGE_TEXT   },
+  { "alpha-percentile", ROCK_STAGE_TEXT   },
+  { "amountx",          ROCK_STAGE_SHAPE  },
+  { "amounty",          ROCK_STAGE_SHAPE  },
+  { "seed",             ROCK_STAGE_SHAPE  },
+  { "gaussian",         ROCK_STAGE_SHAPE  },
+  { "shift",            ROCK_STAGE_SHAPE  },
+  { "seed2",            ROCK_STAGE_SHAPE  },
+  { "size2",            ROCK_STAGE_SHAPE  },
+  { "bounded-reach",    ROCK_STAGE_SHAPE  },
+  /* Switching these relinks the tail of rock text, which starts at noise spread */
+  { "rockblend",        ROCK_STAGE_SHAPE  },
+  { "bevel",            ROCK_STAGE_SHAPE  },
+  { "quality",          ROCK_STAGE_SHAPE  },
+  { "resolution",       ROCK_STAGE_SHAPE  },
+  { "noise-cache",      ROCK_STAGE_SHAPE  },
+  { "azimuth",          ROCK_STAGE_LIGHT  },
+  { "elevation",        ROCK_STAGE_LIGHT  },
+  { "depth",            ROCK_STAGE_LIGHT  },
+  { "bevel-profile",    ROCK_STAGE_LIGHT  },
+  { "bevel-width",      ROCK_STAGE_LIGHT  },
+  { "mvalue",           ROCK_STAGE_FINISH },
+  { "src",              ROCK_STAGE_FINISH },
+  { "x",                ROCK_STAGE_FINISH },
+  { "y",                ROCK_STAGE_FINISH },
+  { "radius",           ROCK_STAGE_FINISH },
+  { "grow-radius",      ROCK_STAGE_FINISH },
+  { "color",            ROCK_STAGE_FINISH },
+  { "opacity",          ROCK_STAGE_FINISH },
+  { "grains",           ROCK_STAGE_FINISH },
+  { "exposure",         ROCK_STAGE_FINISH },
+  { "guichange",        ROCK_STAGE_NONE   },
+};
+
+RockStage
+rock_stage_of_property (const gchar *name)
+{
+  gchar    *key   = g_strdelimit (g_strdup (name), "_", '-');
+  RockStage stage = ROCK_STAGE_TEXT;
+  guint     i;
+
+  for (i = 0; i < G_N_ELEMENTS (rock_stages); i++)
+    if (!strcmp (rock_stages[i].name, key))
+      {
+        stage = rock_stages[i].stage;
+        break;
+      }
+
+  g_free (key);
+  return stage;
+}
+
+const gchar *
+rock_stage_name (RockStage stage)
+{
+  switch (stage)
+    {
+    case ROCK_STAGE_TEXT:   return "full";
+    case ROCK_STAGE_SHAPE:  return "from shape";
+    case ROCK_STAGE_LIGHT:  return "relit";
+    case ROCK_STAGE_FINISH: return "recolored";
+    case ROCK_STAGE_NONE:   break;
+    }
+
+  return "unchanged";
+}
+
+struct _RockFrameWriter
+{
+  GThreadPool *pool;
+  GMutex       mutex;
+  GCond        cond;
+  gint         pending;
+  gint         max_pending;
+  guint        failed;
+};
+
+typedef struct
+{
+  GeglBuffer *buffer;
+  gchar      *path;
+} RockFrame;
+
+static void
+write_frame (gpointer data,
+             gpointer user_data)
+{
+  RockFrame       *frame  = data;
+  RockFrameWriter *writer = user_data;
+  GeglNode        *graph  = gegl_node_new ();
+  GeglNode        *source, *save;
+  gboolean         ok;
+
+  source = gegl_node_new_child (graph,
+                                "operation", "gegl:buffer-source",
+                                "buffer", frame->buffer,
+                                NULL);
+  save   = gegl_node_new_child (graph,
+                                "operation", "gegl:save",
+                                "path", frame->path,
+                                NULL);
+  gegl_node_link (source, save);
+
+  /* gegl:save does not report errors, a file that is not there is one */
+  g_remove (frame->path);
+  gegl_node_process (save);
+  ok = g_file_test (frame->path, G_FILE_TEST_EXISTS);
+
+  g_object_unref (graph);
+
+  g_mutex_lock (&writer->mutex);
+  if (!ok)
+    {
+      writer->failed++;
+      g_printerr ("%s: could not be written\n", frame->path);
+    }
+  writer->pending--;
+  g_cond_signal (&writer->cond);
+  g_mutex_unlock (&writer->mutex);
+
+  g_object_unref (frame->buffer);
+  g_free (frame->path);
+  g_free (frame);
+}
+
+RockFrameWriter *
+rock_frame_writer_new (gint n_threads,
+                       gint max_pending)
+{
+  RockFrameWriter *writer = g_new0 (RockFrameWriter, 1);
+
+  g_mutex_init (&writer->mutex);
+  g_cond_init (&writer->cond);
+  writer->max_pending = MAX (max_pending, 1);
+  writer->pool = g_thread_pool_new (write_frame, writer, MAX (n_threads, 1), FALSE, NULL);
+
+  return writer;
+}
+
+gboolean
+rock_graph_render_frame (RockGraph       *rg,
+                         const RockJob   *job,
+                         RockFrameWriter *writer,
+                         GError         **error)
+{
+  RockFrame     *frame;
+  GeglRectangle  bbox;
+
+  bbox = gegl_node_get_bounding_box (rg->rock);
+  if (gegl_rectangle_is_empty (&bbox) || gegl_rectangle_is_infinite_plane (&bbox))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "%s has no finite extent", job->name);
+      return FALSE;
+    }
+
+  /* Wait for room before rendering, so no more than max_pending frames are held */
+  g_mutex_lock (&writer->mutex);
+  while (writer->pending >= writer->max_pending)
+    g_cond_wait (&writer->cond, &writer->mutex);
+  writer->pending++;
+  g_mutex_unlock (&writer->mutex);
+
+  frame         = g_new0 (RockFrame, 1);
+  frame->buffer = gegl_node_blit_buffer (rg->rock, NULL, &bbox, 0, GEGL_ABYSS_NONE);
+  frame->path   = g_strdup (job->output);
+
+  g_thread_pool_push (writer->pool, frame, NULL);
+  return TRUE;
+}
+
+guint
+rock_frame_writer_free (RockFrameWriter *writer)
+{
+  guint failed;
+
+  if (!writer)
+    return 0;
+
+  g_thread_pool_free (writer->pool, FALSE, TRUE);
+  failed = writer->failed;
+
+  g_mutex_clear (&writer->mutex);
+  g_cond_clear (&writer->cond);
+  g_free (writer);
+
+  return failed;
+}
@@ -0,0 +1,364 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Streaming render of poster sized canvases. The result is pulled from rock text one horizontal band at a
+time and every band is written to the PNG file before the next one is computed. With no caches inside
+rock text (see rock_graph_new) the only full size buffers left are the input layer and the file itself.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <glib/gstdio.h>
+#include "rock-job.h"
+
+#ifdef HAVE_PNG
+#include <png.h>
+#endif
+
+/* lb:edgesmooth: two radius 2 medians and a gaussian of std-dev 0.75 */
+#define EDGESMOOTH_REACH 7
+
+/* The nick of the value an enum property of node holds, so that the values
+ * of rock-text.c's enums are not copied here
+ */
+static const gchar *
+enum_nick (GeglNode    *node,
+           const gchar *name)
+{
+  GParamSpec *pspec = gegl_node_find_property (node, name);
+  GValue      value = G_VALUE_INIT;
+  GEnumValue *ev;
+
+  g_value_init (&value, pspec->value_type);
+  gegl_node_get_property (node, name, &value);
+  ev = g_enum_get_value (G_PARAM_SPEC_ENUM (pspec)->enum_class, g_value_get_enum (&value));
+  g_value_unset (&value);
+
+  return ev ? ev->value_nick : "";
+}
+
+gint
+rock_graph_reach (RockGraph *rg)
+{
+  gint         size, size2, amountx, amounty, shift;
+  gdouble      gaussian, bevel_width, radius, grow_radius, x, y, opacity;
+  const gchar *resolution;
+  gint         f, shape, reach;
+
+  gegl_node_get (rg->rock,
+                 "size",        &size,
+                 "size2",       &size2,
+                 "amountx",     &amountx,
+                 "amounty",     &amounty,
+                 "shift",       &shift,
+                 "gaussian",    &gaussian,
+                 "bevel-width", &bevel_width,
+                 "radius",      &radius,
+                 "grow-radius", &grow_radius,
+                 "x",           &x,
+                 "y",           &y,
+                 "opacity",     &opacity,
+                 NULL);
+
+  resolution = enum_nick (rg->rock, "resolution");
+  f = !strcmp (resolution, "quarter") ? 4 :
+      !strcmp (resolution, "half")    ? 2 : 1;
+
+  reach  = size;                          /* median */
+
+  /* The shape chain, in small pixels when it runs at 1/f of the size */
+  shape  = MAX (amountx, amounty) / f + 1;                /* noise-spread */
+  shape += 3 * (gint) ceil (gaussian / f);                /* FIR gaussian, wider than the draft box */
+  shape += ABS (shift) / f + 1;                           /* shift */
+  shape += size2 / f + 1;                                 /* median2 */
+  if (f > 1)
+    shape += 1 + 2;                                       /* scale down, upsample taps */
+  reach += shape * f;
+
+  if (!strcmp (enum_nick (rg->rock, "bevel"), "distance"))
+    reach += (gint) ceil (bevel_width) + 2;               /* lb:rock-bevel */
+  else
+    reach += 1;                                           /* emboss */
+
+  if (!strcmp (enum_nick (rg->rock, "quality"), "draft"))
+    reach += 1;                                           /* radius 1 median */
+  else
+    reach += 1 + EDGESMOOTH_REACH;                        /* mean curvature blur, edgesmooth */
+
+  if (opacity > 0.0)
+    reach += (gint) ceil (fabs (grow_radius)) + 3 * (gint) ceil (radius) +
+             (gint) ceil (MAX (fabs (x), fabs (y))) + 1;
+
+  return reach;
+}
+
+gboolean
+rock_graph_render_dirty (RockGraph           *rg,
+                         const RockJob       *job,
+                         const GeglRectangle *dirty,
+                         const gchar         *output,
+                         GeglRectangle       *rendered,
+                         GError             **error)
+{
+  GeglBuffer          *previous = NULL;
+  GeglBuffer          *placed;
+  GeglNode            *graph, *load, *sink;
+  GeglRectangle        bbox, grown;
+  const GeglRectangle *extent;
+  gint                 reach;
+  gboolean             ok;
+
+  if (!output)
+    output = job->output;
+
+  bbox = gegl_node_get_bounding_box (rg->rock);
+
+  if (g_file_test (output, G_FILE_TEST_EXISTS))
+    {
+      graph = gegl_node_new ();
+      load  = gegl_node_new_child (graph,
+                                   "operation", "gegl:load",
+                                   "path", output,
+                                   NULL);
+      sink  = gegl_node_new_child (graph,
+                                   "operation", "gegl:buffer-sink",
+                                   "buffer", &previous,
+                                   NULL);
+      gegl_node_link (load, sink);
+      gegl_node_process (sink);
+      g_object_unref (graph);
+    }
+
+  /* A PNG has no offset, it starts at 0,0 wherever the result does */
+  extent = previous ? gegl_buffer_get_extent (previous) : NULL;
+  if (!extent || extent->width != bbox.width || extent->height != bbox.height)
+    {
+      g_clear_object (&previous);
+      *rendered = bbox;
+      return rock_graph_render (rg, job, NULL, output, error);
+    }
+
+  reach = rock_graph_reach (rg);
+  grown = *dirty;
+  grown.x      -= reach;
+  grown.y      -= reach;
+  grown.width  += 2 * reach;
+  grown.height += 2 * reach;
+  gegl_rectangle_intersect (rendered, &grown, &bbox);
+
+  /* The earlier output seen at the coordinates of the result */
+  placed = g_object_new (GEGL_TYPE_BUFFER,
+                         "source",  previous,
+                         "shift-x", extent->x - bbox.x,
+                         "shift-y", extent->y - bbox.y,
+                         "x",       bbox.x,
+                         "y",       bbox.y,
+                         "width",   bbox.width,
+                         "height",  bbox.height,
+                         NULL);
+
+  if (!gegl_rectangle_is_empty (rendered))
+    gegl_node_blit_buffer (rg->rock, placed, rendered, 0, GEGL_ABYSS_NONE);
+  g_object_unref (placed);
+
+  gegl_node_set (rg->source, "buffer", previous, NULL);
+  gegl_node_set (rg->save, "path", output, NULL);
+  gegl_node_link (rg->source, rg->save);
+  ok = rock_graph_save (rg, error);
+
+  gegl_node_set (rg->source, "buffer", NULL, NULL);
+  g_object_unref (previous);
+
+  return ok;
+}
+
+#ifdef HAVE_PNG
+
+typedef struct
+{
+  FILE        *fp;
+  png_structp  png;
+  png_infop    info;
+} BandWriter;
+
+static gboolean
+band_writer_open (BandWriter   *writer,
+                  const gchar  *path,
+                  gint          width,
+                  gint          height,
+                  GError      **error)
+{
+  writer->fp = g_fopen (path, "wb");
+  if (!writer->fp)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "can not write %s", path);
+      return FALSE;
+    }
+
+  writer->png  = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  writer->info = writer->png ? png_create_info_struct (writer->png) : NULL;
+  if (!writer->info || setjmp (png_jmpbuf (writer->png)))
+    {
+      png_destroy_write_struct (&writer->png, &writer->info);
+      fclose (writer->fp);
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                   "libpng could not start %s", path);
+      return FALSE;
+    }
+
+  png_init_io (writer->png, writer->fp);
+  png_set_IHDR (writer->png, writer->info, width, height, 8,
+                PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_write_info (writer->png, writer->info);
+
+  return TRUE;
+}
+
+static gboolean
+band_writer_rows (BandWriter *writer,
+                  guchar     *pixels,
+                  gint        rowstride,
+                  gint        n_rows)
+{
+  gint y;
+
+  if (setjmp (png_jmpbuf (writer->png)))
+    return FALSE;
+
+  for (y = 0; y < n_rows; y++)
+    png_write_row (writer->png, pixels + y * rowstride);
+
+  return TRUE;
+}
+
+static gboolean
+band_writer_close (BandWriter *writer,
+                   gboolean    finish)
+{
+  gboolean ok = TRUE;
+
+  if (finish)
+    {
+      if (setjmp (png_jmpbuf (writer->png)))
+        ok = FALSE;
+      else
+        png_write_end (writer->png, NULL);
+    }
+
+  png_destroy_write_struct (&writer->png, &writer->info);
+  if (fclose (writer->fp))
+    ok = FALSE;
+
+  return ok;
+}
+
+gboolean
+rock_graph_render_bands (RockGraph           *rg,
+                         const RockJob       *job,
+                         const GeglRectangle *region,
+                         const gchar         *output,
+                         gint                 band_height,
+                         GError             **error)
+{
+  const Babl    *format = babl_format ("R'G'B'A u8");
+  GeglRectangle  bounds;
+  BandWriter     writer;
+  guchar        *pixels;
+  gint           rowstride;
+  gint           y;
+  gboolean       ok = TRUE;
+
+  if (!output)
+    output = job->output;
+
+  if (!rg->streaming || band_height <= 0)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "band rendering needs a streaming graph and a band height");
+      return FALSE;
+    }
+
+  if (!g_str_has_suffix (output, ".png") && !g_str_has_suffix (output, ".PNG"))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "band rendering only writes .png files, not %s", output);
+      return FALSE;
+    }
+
+  bounds = gegl_node_get_bounding_box (rg->rock);
+  if (region)
+    gegl_rectangle_intersect (&bounds, &bounds, region);
+
+  if (bounds.width <= 0 || bounds.height <= 0)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "nothing to render for %s", output);
+      return FALSE;
+    }
+
+  if (!band_writer_open (&writer, output, bounds.width, bounds.height, error))
+    return FALSE;
+
+  band_height = MIN (band_height, bounds.height);
+  rowstride   = bounds.width * 4;
+  pixels      = g_malloc ((gsize) rowstride * band_height);
+
+  for (y = bounds.y; y < bounds.y + bounds.height && ok; y += band_height)
+    {
+      GeglRectangle band = { bounds.x, y, bounds.width,
+                             MIN (band_height, bounds.y + bounds.height - y) };
+
+      gegl_node_blit (rg->rock, 1.0, &band, format, pixels,
+                      rowstride, GEGL_BLIT_DEFAULT);
+
+      ok = band_writer_rows (&writer, pixels, rowstride, band.height);
+    }
+
+  if (!band_writer_close (&writer, ok) || !ok)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_IO,
+                   "libpng could not write %s", output);
+      ok = FALSE;
+    }
+
+  g_free (pixels);
+  return ok;
+}
+
+#else
+
+gboolean
+rock_graph_render_bands (RockGraph           *rg,
+                         const RockJob       *job,
+                         const GeglRectangle *region,
+                         const gchar         *output,
+                         gint                 band_height,
+                         GError             **error)
+{
+  g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOSYS,
+               "rock-text-batch was built without libpng, band rendering is not available");
+  return FALSE;
+}
+
+#endif
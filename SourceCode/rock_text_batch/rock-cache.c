@@ -0,0 +1,564 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include "rock-cache.h"
+
+/* Bump when rock text renders differently for the same properties */
+#define ROCK_CACHE_VERSION "rock-text-cache-1"
+#define ROCK_CACHE_SUFFIX  ".rock"
+#define ROCK_CACHE_MAGIC   "ROCKTXT1"
+
+/* The helper ops change the graph rock text builds, and their output changes
+ * with their reference-hash, so both are part of the key
+ */
+static const gchar *helper_ops[] =
+{
+  "lb:edgesmooth",
+  "lb:rock-colorize",
+  "lb:rock-finish",
+  "lb:rock-outline",
+  "lb:rock-bevel",
+  "lb:rock-upsample",
+  "lb:rock-median",
+  "lb:rock-spread",
+};
+
+typedef struct
+{
+  gchar  magic[8];
+  gint32 x;
+  gint32 y;
+  gint32 width;
+  gint32 height;
+} RockCacheHeader;
+
+struct _RockCache
+{
+  gchar   *dir;
+  guint64  max_bytes;
+  guint64  total_bytes;
+  GMutex   mutex;
+};
+
+typedef struct
+{
+  gchar  *path;
+  gint64  mtime;
+  guint64 size;
+} RockCacheEntry;
+
+static void
+rock_cache_entry_free (gpointer data)
+{
+  RockCacheEntry *entry = data;
+
+  g_free (entry->path);
+  g_free (entry);
+}
+
+static gint
+entry_cmp_mtime (gconstpointer a,
+                 gconstpointer b)
+{
+  const RockCacheEntry *ea = *(RockCacheEntry **) a;
+  const RockCacheEntry *eb = *(RockCacheEntry **) b;
+
+  return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+/* Every entry of the cache folder, with the sum of their sizes */
+static GPtrArray *
+list_entries (RockCache *cache,
+              guint64   *total)
+{
+  GPtrArray   *entries = g_ptr_array_new_with_free_func (rock_cache_entry_free);
+  GDir        *dir     = g_dir_open (cache->dir, 0, NULL);
+  const gchar *name;
+
+  *total = 0;
+  if (!dir)
+    return entries;
+
+  while ((name = g_dir_read_name (dir)))
+    {
+      RockCacheEntry *entry;
+      GStatBuf        st;
+      gchar          *path;
+
+      if (!g_str_has_suffix (name, ROCK_CACHE_SUFFIX))
+        continue;
+
+      path = g_build_filename (cache->dir, name, NULL);
+      if (g_stat (path, &st))
+        {
+          g_free (path);
+          continue;
+        }
+
+      entry        = g_new (RockCacheEntry, 1);
+      entry->path  = path;
+      entry->mtime = st.st_mtime;
+      entry->size  = st.st_size;
+      *total += entry->size;
+      g_ptr_array_add (entries, entry);
+    }
+
+  g_dir_close (dir);
+  return entries;
+}
+
+RockCache *
+rock_cache_new (const gchar  *dir,
+                guint64       max_bytes,
+                GError      **error)
+{
+  RockCache *cache;
+  GPtrArray *entries;
+
+  if (g_mkdir_with_parents (dir, 0755))
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "can not create cache folder %s", dir);
+      return NULL;
+    }
+
+  cache            = g_new0 (RockCache, 1);
+  cache->dir       = g_strdup (dir);
+  cache->max_bytes = max_bytes;
+  g_mutex_init (&cache->mutex);
+
+  entries = list_entries (cache, &cache->total_bytes);
+  g_ptr_array_unref (entries);
+
+  return cache;
+}
+
+void
+rock_cache_free (RockCache *cache)
+{
+  if (!cache)
+    return;
+
+  g_mutex_clear (&cache->mutex);
+  g_free (cache->dir);
+  g_free (cache);
+}
+
+/* Deletes the least recently used entries until the folder is back under
+ * nine tenths of its limit, so not every store has to evict again.
+ */
+static void
+evict (RockCache *cache)
+{
+  GPtrArray *entries = list_entries (cache, &cache->total_bytes);
+  guint64    target  = cache->max_bytes / 10 * 9;
+  guint      i;
+
+  g_ptr_array_sort (entries, entry_cmp_mtime);
+
+  for (i = 0; i < entries->len && cache->total_bytes > target; i++)
+    {
+      RockCacheEntry *entry = g_ptr_array_index (entries, i);
+
+      if (!g_unlink (entry->path))
+        cache->total_bytes -= entry->size;
+    }
+
+  g_ptr_array_unref (entries);
+}
+
+static void
+checksum_value (GChecksum    *checksum,
+                GParamSpec   *pspec,
+                const GValue *value)
+{
+  g_checksum_update (checksum, (const guchar *) pspec->name, -1);
+
+  if (G_PARAM_SPEC_VALUE_TYPE (pspec) == GEGL_TYPE_COLOR)
+    {
+      GeglColor *color   = g_value_get_object (value);
+      gdouble    rgba[4] = { 0, };
+
+      if (color)
+        gegl_color_get_rgba (color, &rgba[0], &rgba[1], &rgba[2], &rgba[3]);
+      g_checksum_update (checksum, (const guchar *) rgba, sizeof (rgba));
+    }
+  else
+    {
+      gchar *contents = g_strdup_value_contents (value);
+
+      g_checksum_update (checksum, (const guchar *) contents, -1);
+      g_free (contents);
+    }
+}
+
+static gboolean
+checksum_file (GChecksum    *checksum,
+               const gchar  *path,
+               GError      **error)
+{
+  GMappedFile *mapped = g_mapped_file_new (path, FALSE, error);
+
+  if (!mapped)
+    return FALSE;
+
+  g_checksum_update (checksum,
+                     (const guchar *) g_mapped_file_get_contents (mapped),
+                     g_mapped_file_get_length (mapped));
+  g_mapped_file_unref (mapped);
+
+  return TRUE;
+}
+
+/* The overlay is identified by path, size and mtime, hashing it on every
+ * job would cost more than loading it. The mtime is in microseconds, like the
+ * resolve cache of port:load, so a rewrite of the same size within one
+ * second still misses.
+ */
+static void
+checksum_file_identity (GChecksum   *checksum,
+                        const gchar *path)
+{
+  GFile     *file;
+  GFileInfo *info = NULL;
+  gint64     identity[2] = { -1, -1 };
+
+  if (path && path[0])
+    {
+      file = g_file_new_for_path (path);
+      info = g_file_query_info (file,
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC ","
+                                G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                G_FILE_QUERY_INFO_NONE, NULL, NULL);
+      g_object_unref (file);
+    }
+
+  if (info)
+    {
+      identity[0] = g_file_info_get_size (info);
+      identity[1] = (gint64) g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+                    g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+      g_object_unref (info);
+    }
+  g_checksum_update (checksum, (const guchar *) identity, sizeof (identity));
+}
+
+/* Everything in the key comes from the job, not from the graph, so a hit
+ * is found without applying the job: rock text would already render its
+ * text mask while its properties are set.
+ */
+static gchar *
+cache_key (RockGraph            *rg,
+           const RockJob        *job,
+           const GeglRectangle  *region,
+           GError              **error)
+{
+  GChecksum   *checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  const gchar *op       = gegl_node_get_operation (rg->rock);
+  GParamSpec **pspecs;
+  guint        n_pspecs, i;
+  gint         version[3];
+  gint32       rect[5] = { region != NULL, 0, 0, 0, 0 };
+  guchar       bounded = rg->bounded;
+  gchar       *key;
+  const gchar *src       = NULL;
+  const gchar *reference = gegl_operation_get_key (op, "reference-hash");
+
+  g_checksum_update (checksum, (const guchar *) ROCK_CACHE_VERSION, -1);
+  if (reference)
+    g_checksum_update (checksum, (const guchar *) reference, -1);
+  gegl_get_version (&version[0], &version[1], &version[2]);
+  g_checksum_update (checksum, (const guchar *) version, sizeof (version));
+
+  for (i = 0; i < G_N_ELEMENTS (helper_ops); i++)
+    {
+      guchar       has    = gegl_has_operation (helper_ops[i]);
+      const gchar *helper = has ? gegl_operation_get_key (helper_ops[i], "reference-hash") : NULL;
+
+      g_checksum_update (checksum, &has, 1);
+      if (helper)
+        g_checksum_update (checksum, (const guchar *) helper, -1);
+    }
+
+  pspecs = gegl_operation_list_properties (op, &n_pspecs);
+  for (i = 0; i < n_pspecs; i++)
+    {
+      GValue value = G_VALUE_INIT;
+
+      g_value_init (&value, G_PARAM_SPEC_VALUE_TYPE (pspecs[i]));
+      if (!rock_job_property_value (job, pspecs[i], &value, error))
+        {
+          g_value_unset (&value);
+          g_free (pspecs);
+          g_checksum_free (checksum);
+          return NULL;
+        }
+      checksum_value (checksum, pspecs[i], &value);
+      g_value_unset (&value);
+    }
+  g_free (pspecs);
+
+  /* rock_graph_apply turns bounded-reach on for bounded graphs */
+  g_checksum_update (checksum, &bounded, 1);
+
+  for (i = 0; job->keys[i]; i++)
+    if (!strcmp (job->keys[i], "src"))
+      src = job->values[i];
+  checksum_file_identity (checksum, src);
+
+  if (region)
+    {
+      rect[1] = region->x;
+      rect[2] = region->y;
+      rect[3] = region->width;
+      rect[4] = region->height;
+    }
+  g_checksum_update (checksum, (const guchar *) rect, sizeof (rect));
+
+  if (job->input && !checksum_file (checksum, job->input, error))
+    {
+      g_checksum_free (checksum);
+      return NULL;
+    }
+
+  key = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return key;
+}
+
+/* Maps the entry at path, NULL when there is none or it is not whole. The
+ * extent of the result comes from its header.
+ */
+static GMappedFile *
+lookup (const gchar   *path,
+        GeglRectangle *extent)
+{
+  GMappedFile     *mapped = g_mapped_file_new (path, FALSE, NULL);
+  RockCacheHeader *header;
+
+  if (!mapped)
+    return NULL;
+
+  header = (RockCacheHeader *) g_mapped_file_get_contents (mapped);
+  if (g_mapped_file_get_length (mapped) < sizeof (RockCacheHeader) ||
+      memcmp (header->magic, ROCK_CACHE_MAGIC, sizeof (header->magic)) ||
+      header->width <= 0 || header->height <= 0 ||
+      g_mapped_file_get_length (mapped) != sizeof (RockCacheHeader) +
+        (gsize) header->width * header->height * 4 * sizeof (gfloat))
+    {
+      g_mapped_file_unref (mapped);
+      return NULL;
+    }
+
+  gegl_rectangle_set (extent, header->x, header->y, header->width, header->height);
+
+  /* The mtime is the last use, for the eviction order */
+  g_utime (path, NULL);
+
+  return mapped;
+}
+
+static void
+store (RockCache           *cache,
+       const gchar         *path,
+       const GeglRectangle *extent,
+       const gfloat        *pixels,
+       gsize                n_bytes)
+{
+  RockCacheHeader header;
+  gchar          *tmp;
+  FILE           *fp;
+  gint            fd;
+  gboolean        ok;
+
+  memcpy (header.magic, ROCK_CACHE_MAGIC, sizeof (header.magic));
+  header.x      = extent->x;
+  header.y      = extent->y;
+  header.width  = extent->width;
+  header.height = extent->height;
+
+  /* Written aside under a unique name and renamed, so other threads and
+   * processes never map half an entry or write into the same file
+   */
+  tmp = g_strconcat (path, ".XXXXXX", NULL);
+  fd  = g_mkstemp (tmp);
+  fp  = fd < 0 ? NULL : fdopen (fd, "wb");
+  if (!fp)
+    {
+      if (fd >= 0)
+        {
+          g_close (fd, NULL);
+          g_unlink (tmp);
+        }
+      g_free (tmp);
+      return;
+    }
+
+  ok = fwrite (&header, sizeof (header), 1, fp) == 1 &&
+       fwrite (pixels, 1, n_bytes, fp) == n_bytes;
+  ok = !fclose (fp) && ok;
+
+  if (!ok || g_rename (tmp, path))
+    {
+      g_unlink (tmp);
+      g_free (tmp);
+      return;
+    }
+  g_free (tmp);
+
+  g_mutex_lock (&cache->mutex);
+  cache->total_bytes += sizeof (header) + n_bytes;
+  if (cache->total_bytes > cache->max_bytes)
+    evict (cache);
+  g_mutex_unlock (&cache->mutex);
+}
+
+static gchar *
+entry_path (RockCache           *cache,
+            RockGraph           *rg,
+            const RockJob       *job,
+            const GeglRectangle *region,
+            GError             **error)
+{
+  gchar *key  = cache_key (rg, job, region, error);
+  gchar *name, *path;
+
+  if (!key)
+    return NULL;
+
+  name = g_strconcat (key, ROCK_CACHE_SUFFIX, NULL);
+  path = g_build_filename (cache->dir, name, NULL);
+  g_free (name);
+  g_free (key);
+
+  return path;
+}
+
+/* Saves pixels of extent through the buffer source of rg */
+static gboolean
+save_pixels (RockGraph           *rg,
+             const gfloat        *pixels,
+             const GeglRectangle *extent,
+             const gchar         *output,
+             GError             **error)
+{
+  GeglBuffer *buffer;
+  gboolean    ok;
+
+  buffer = gegl_buffer_linear_new_from_data ((gpointer) pixels, babl_format ("RGBA float"),
+                                             extent, GEGL_AUTO_ROWSTRIDE, NULL, NULL);
+
+  gegl_node_set (rg->source, "buffer", buffer, NULL);
+  gegl_node_set (rg->save, "path", output, NULL);
+  gegl_node_link (rg->source, rg->save);
+  ok = rock_graph_save (rg, error);
+
+  /* Let go of the pixels before they are unmapped or freed */
+  gegl_node_set (rg->source, "buffer", NULL, NULL);
+  g_object_unref (buffer);
+
+  return ok;
+}
+
+gboolean
+rock_cache_save_hit (RockCache           *cache,
+                     RockGraph           *rg,
+                     const RockJob       *job,
+                     const GeglRectangle *region,
+                     const gchar         *output,
+                     gboolean            *hit,
+                     GError             **error)
+{
+  GeglRectangle  extent;
+  GMappedFile   *mapped;
+  gchar         *path;
+  gboolean       ok;
+
+  *hit = FALSE;
+
+  path = entry_path (cache, rg, job, region, error);
+  if (!path)
+    return FALSE;
+
+  mapped = lookup (path, &extent);
+  g_free (path);
+  if (!mapped)
+    return TRUE;
+
+  *hit = TRUE;
+  ok   = save_pixels (rg,
+                      (const gfloat *) (g_mapped_file_get_contents (mapped) + sizeof (RockCacheHeader)),
+                      &extent, output ? output : job->output, error);
+  g_mapped_file_unref (mapped);
+
+  return ok;
+}
+
+gboolean
+rock_cache_render (RockCache           *cache,
+                   RockGraph           *rg,
+                   const RockJob       *job,
+                   const GeglRectangle *region,
+                   const gchar         *output,
+                   GError             **error)
+{
+  GeglRectangle  extent;
+  gfloat        *pixels;
+  gsize          n_bytes;
+  gchar         *path;
+  gboolean       ok;
+
+  if (!output)
+    output = job->output;
+
+  extent = gegl_node_get_bounding_box (rg->rock);
+  if (region)
+    gegl_rectangle_intersect (&extent, &extent, region);
+
+  if (extent.width <= 0 || extent.height <= 0)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "nothing to render for %s", output);
+      return FALSE;
+    }
+
+  path = entry_path (cache, rg, job, region, error);
+  if (!path)
+    return FALSE;
+
+  n_bytes = (gsize) extent.width * extent.height * 4 * sizeof (gfloat);
+  pixels  = g_malloc (n_bytes);
+  gegl_node_blit (rg->rock, 1.0, &extent, babl_format ("RGBA float"), pixels,
+                  GEGL_AUTO_ROWSTRIDE, GEGL_BLIT_DEFAULT);
+  store (cache, path, &extent, pixels, n_bytes);
+
+  ok = save_pixels (rg, pixels, &extent, output, error);
+
+  g_free (pixels);
+  g_free (path);
+
+  return ok;
+}
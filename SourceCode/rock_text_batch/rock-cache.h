@@ -0,0 +1,66 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+#pragma once
+
+#include "rock-job.h"
+
+G_BEGIN_DECLS
+
+/* An on disk cache of finished renders, shared by every thread and every
+ * run that points at the same folder. Entries are named after a SHA-256 of
+ * everything that decides the result: the input file contents, every
+ * lb:rock-text property, the overlay fileꞌs path, size and mtime, the
+ * region and the version of rock text. Each entry is a small header and
+ * the raw RGBA float pixels, mapped straight into a GeglBuffer on a hit.
+ *
+ * When the folder grows over its size limit the least recently used
+ * entries (oldest mtime, hits touch their entry) are deleted.
+ */
+typedef struct _RockCache RockCache;
+
+RockCache *rock_cache_new    (const gchar  *dir,
+                              guint64       max_bytes,
+                              GError      **error);
+void       rock_cache_free   (RockCache    *cache);
+
+/* Looks the job up before it is applied to rg: rock text would already
+ * render its text mask while its properties are set. On a hit the cached
+ * pixels are saved to output (or the jobꞌs output) and hit is set, else
+ * nothing is done. rg is only used for its save nodes and bounded flag.
+ */
+gboolean   rock_cache_save_hit (RockCache    *cache,
+                                RockGraph    *rg,
+                                const RockJob *job,
+                                const GeglRectangle *region,
+                                const gchar  *output,
+                                gboolean     *hit,
+                                GError      **error);
+
+/* Like rock_graph_render (after rock_graph_apply), and stores the result
+ * in the cache, for a job rock_cache_save_hit did not find.
+ */
+gboolean   rock_cache_render   (RockCache    *cache,
+                                RockGraph    *rg,
+                                const RockJob *job,
+                                const GeglRectangle *region,
+                                const gchar  *output,
+                                GError      **error);
+
+G_END_DECLS
@@ -0,0 +1,173 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+#include <math.h>
+#include "rock-compare.h"
+
+#define SSIM_WINDOW 8
+#define SSIM_C1     (0.01 * 0.01)
+#define SSIM_C2     (0.03 * 0.03)
+
+static GeglBuffer *
+load_buffer (const gchar  *path,
+             GError      **error)
+{
+  GeglBuffer *buffer = NULL;
+  GeglNode   *graph, *load, *sink;
+
+  if (!g_file_test (path, G_FILE_TEST_IS_REGULAR))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOENT,
+                   "%s does not exist", path);
+      return NULL;
+    }
+
+  graph = gegl_node_new ();
+  load  = gegl_node_new_child (graph,
+                               "operation", "gegl:load",
+                               "path",      path,
+                               NULL);
+  sink  = gegl_node_new_child (graph,
+                               "operation", "gegl:buffer-sink",
+                               "buffer",    &buffer,
+                               NULL);
+  gegl_node_link (load, sink);
+  gegl_node_process (sink);
+  g_object_unref (graph);
+
+  if (!buffer)
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                 "could not load %s", path);
+
+  return buffer;
+}
+
+/* Luma of a R'G'B'A pixel over black */
+static inline gdouble
+luma (const gfloat *pixel)
+{
+  return (0.2126 * pixel[0] + 0.7152 * pixel[1] + 0.0722 * pixel[2]) * pixel[3];
+}
+
+static gdouble
+mean_ssim (const gfloat *a,
+           const gfloat *b,
+           gint          width,
+           gint          height)
+{
+  gdouble sum = 0.0;
+  gint    n_windows = 0;
+  gint    wx, wy, x, y;
+
+  for (wy = 0; wy < height; wy += SSIM_WINDOW)
+    for (wx = 0; wx < width; wx += SSIM_WINDOW)
+      {
+        gint    x1 = MIN (wx + SSIM_WINDOW, width);
+        gint    y1 = MIN (wy + SSIM_WINDOW, height);
+        gint    n  = (x1 - wx) * (y1 - wy);
+        gdouble sa = 0.0, sb = 0.0, saa = 0.0, sbb = 0.0, sab = 0.0;
+        gdouble ma, mb, va, vb, cov;
+
+        for (y = wy; y < y1; y++)
+          for (x = wx; x < x1; x++)
+            {
+              gdouble la = luma (a + (y * width + x) * 4);
+              gdouble lb = luma (b + (y * width + x) * 4);
+
+              sa  += la;
+              sb  += lb;
+              saa += la * la;
+              sbb += lb * lb;
+              sab += la * lb;
+            }
+
+        ma  = sa / n;
+        mb  = sb / n;
+        va  = saa / n - ma * ma;
+        vb  = sbb / n - mb * mb;
+        cov = sab / n - ma * mb;
+
+        sum += ((2.0 * ma * mb + SSIM_C1) * (2.0 * cov + SSIM_C2)) /
+               ((ma * ma + mb * mb + SSIM_C1) * (va + vb + SSIM_C2));
+        n_windows++;
+      }
+
+  return n_windows ? sum / n_windows : 1.0;
+}
+
+gboolean
+rock_compare_files (const gchar       *path,
+                    const gchar       *reference,
+                    RockCompareResult *result,
+                    GError           **error)
+{
+  const Babl    *format = babl_format ("R'G'B'A float");
+  GeglBuffer    *a, *b;
+  GeglRectangle  ea, eb;
+  gfloat        *pa, *pb;
+  gsize          n, i;
+  gdouble        sum = 0.0;
+
+  a = load_buffer (path, error);
+  if (!a)
+    return FALSE;
+
+  b = load_buffer (reference, error);
+  if (!b)
+    {
+      g_object_unref (a);
+      return FALSE;
+    }
+
+  ea = *gegl_buffer_get_extent (a);
+  eb = *gegl_buffer_get_extent (b);
+  if (ea.width != eb.width || ea.height != eb.height)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "%s is %dx%d, the reference is %dx%d", path,
+                   ea.width, ea.height, eb.width, eb.height);
+      g_object_unref (a);
+      g_object_unref (b);
+      return FALSE;
+    }
+
+  n  = (gsize) ea.width * ea.height * 4;
+  pa = g_new (gfloat, n);
+  pb = g_new (gfloat, n);
+  gegl_buffer_get (a, &ea, 1.0, format, pa, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  gegl_buffer_get (b, &eb, 1.0, format, pb, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  result->max_diff = 0.0;
+  for (i = 0; i < n; i++)
+    {
+      gdouble diff = fabs ((gdouble) pa[i] - pb[i]);
+
+      result->max_diff = MAX (result->max_diff, diff);
+      sum += diff;
+    }
+  result->mean_diff = n ? sum / n : 0.0;
+  result->ssim      = mean_ssim (pa, pb, ea.width, ea.height);
+
+  g_free (pa);
+  g_free (pb);
+  g_object_unref (a);
+  g_object_unref (b);
+
+  return TRUE;
+}
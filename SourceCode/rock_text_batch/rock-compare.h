@@ -0,0 +1,42 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+#pragma once
+
+#include <gegl.h>
+
+G_BEGIN_DECLS
+
+/* How far a render is from its reference image. Differences are measured
+ * on R'G'B'A in 0..1, ssim is the mean structural similarity of the luma
+ * (over black) in 8x8 windows, 1.0 for identical images.
+ */
+typedef struct
+{
+  gdouble max_diff;
+  gdouble mean_diff;
+  gdouble ssim;
+} RockCompareResult;
+
+gboolean rock_compare_files (const gchar       *path,
+                             const gchar       *reference,
+                             RockCompareResult *result,
+                             GError           **error);
+
+G_END_DECLS
@@ -0,0 +1,916 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib/gstdio.h>
+#include "rock-job.h"
+
+#define ROCK_TEXT_OP "lb:rock-text"
+
+static gboolean
+is_job_key (const gchar *key)
+{
+  return !strcmp (key, "input")  ||
+         !strcmp (key, "output") ||
+         !strcmp (key, "seeds")  ||
+         !strcmp (key, "seeds2") ||
+         !strcmp (key, "budget-ms") ||
+         !strcmp (key, "memory-mb") ||
+         !strcmp (key, "frames");
+}
+
+void
+rock_job_free (RockJob *job)
+{
+  if (!job)
+    return;
+
+  g_free (job->name);
+  g_free (job->family);
+  g_free (job->input);
+  g_free (job->output);
+  g_strfreev (job->keys);
+  g_strfreev (job->values);
+  g_free (job);
+}
+
+RockJob *
+rock_job_with_property (const RockJob *job,
+                        const gchar   *name,
+                        const gchar   *value,
+                        const gchar   *output)
+{
+  RockJob   *copy   = g_new0 (RockJob, 1);
+  GPtrArray *names  = g_ptr_array_new ();
+  GPtrArray *values = g_ptr_array_new ();
+  gint       i;
+
+  copy->name      = g_strdup (job->name);
+  copy->family    = g_strdup (job->family);
+  copy->input     = g_strdup (job->input);
+  copy->output    = g_strdup (output);
+  copy->budget_ms = job->budget_ms;
+  copy->memory_mb = job->memory_mb;
+  copy->animated  = job->animated;
+  copy->frame     = job->frame;
+  copy->stage     = job->stage;
+
+  for (i = 0; job->keys[i]; i++)
+    {
+      gchar   *key  = g_strdelimit (g_strdup (job->keys[i]), "_", '-');
+      gboolean same = !strcmp (key, name);
+
+      g_free (key);
+      if (same)
+        continue;
+
+      g_ptr_array_add (names, g_strdup (job->keys[i]));
+      g_ptr_array_add (values, g_strdup (job->values[i]));
+    }
+
+  g_ptr_array_add (names, g_strdup (name));
+  g_ptr_array_add (values, g_strdup (value));
+  g_ptr_array_add (names, NULL);
+  g_ptr_array_add (values, NULL);
+  copy->keys   = (gchar **) g_ptr_array_free (names, FALSE);
+  copy->values = (gchar **) g_ptr_array_free (values, FALSE);
+
+  return copy;
+}
+
+gchar *
+rock_output_with_tag (const gchar *output,
+                      const gchar *placeholder,
+                      const gchar *tag)
+{
+  const gchar *dot   = strrchr (output, '.');
+  const gchar *slash = strrchr (output, G_DIR_SEPARATOR);
+  gchar       *result;
+
+  if (strstr (output, placeholder))
+    {
+      gchar **parts = g_strsplit (output, placeholder, -1);
+      result = g_strjoinv (tag, parts);
+      g_strfreev (parts);
+    }
+  else if (dot && (!slash || dot > slash))
+    {
+      result = g_strdup_printf ("%.*s-%s%s",
+                                (gint) (dot - output), output, tag, dot);
+    }
+  else
+    {
+      result = g_strdup_printf ("%s-%s", output, tag);
+    }
+
+  return result;
+}
+
+static RockJob *
+rock_job_new_variant (const RockJob *base,
+                      gint           seed,
+                      gboolean       has_seed2,
+                      gint           seed2)
+{
+  RockJob   *job    = g_new0 (RockJob, 1);
+  GPtrArray *names  = g_ptr_array_new ();
+  GPtrArray *values = g_ptr_array_new ();
+  gchar     *seed_str;
+  gint       i;
+
+  job->name   = g_strdup_printf ("%s/%d", base->name, seed);
+  job->family = g_strdup (base->name);
+  job->input  = g_strdup (base->input);
+  job->budget_ms = base->budget_ms;
+  job->memory_mb = base->memory_mb;
+  seed_str    = g_strdup_printf ("%d", seed);
+  job->output = rock_output_with_tag (base->output, "{seed}", seed_str);
+  g_free (seed_str);
+
+  for (i = 0; base->keys[i]; i++)
+    {
+      if (!strcmp (base->keys[i], "seed") ||
+          (has_seed2 && !strcmp (base->keys[i], "seed2")))
+        continue;
+
+      g_ptr_array_add (names, g_strdup (base->keys[i]));
+      g_ptr_array_add (values, g_strdup (base->values[i]));
+    }
+
+  g_ptr_array_add (names, g_strdup ("seed"));
+  g_ptr_array_add (values, g_strdup_printf ("%d", seed));
+  if (has_seed2)
+    {
+      g_ptr_array_add (names, g_strdup ("seed2"));
+      g_ptr_array_add (values, g_strdup_printf ("%d", seed2));
+    }
+
+  g_ptr_array_add (names, NULL);
+  g_ptr_array_add (values, NULL);
+  job->keys   = (gchar **) g_ptr_array_free (names, FALSE);
+  job->values = (gchar **) g_ptr_array_free (values, FALSE);
+
+  return job;
+}
+
+static RockJob *
+rock_job_from_group (GKeyFile     *kf,
+                     const gchar  *group,
+                     GError      **error)
+{
+  RockJob   *job = g_new0 (RockJob, 1);
+  gchar    **keys;
+  GPtrArray *names  = g_ptr_array_new ();
+  GPtrArray *values = g_ptr_array_new ();
+  gchar     *stray  = NULL;
+  gsize      n_keys, i;
+
+  job->name   = g_strdup (group);
+  job->input  = g_key_file_get_string (kf, group, "input", NULL);
+  job->output = g_key_file_get_string (kf, group, "output", NULL);
+  job->budget_ms = g_key_file_get_double (kf, group, "budget-ms", NULL);
+  job->memory_mb = g_key_file_get_integer (kf, group, "memory-mb", NULL);
+
+  keys = g_key_file_get_keys (kf, group, &n_keys, NULL);
+  for (i = 0; i < n_keys; i++)
+    {
+      if (is_job_key (keys[i]))
+        continue;
+
+      /* Keyframes, see rock_jobs_from_timeline */
+      if (strchr (keys[i], '@'))
+        {
+          if (!stray && !g_key_file_has_key (kf, group, "frames", NULL))
+            stray = g_strdup (keys[i]);
+          continue;
+        }
+
+      g_ptr_array_add (names, g_strdup (keys[i]));
+      g_ptr_array_add (values, g_key_file_get_string (kf, group, keys[i], NULL));
+    }
+  g_strfreev (keys);
+
+  g_ptr_array_add (names, NULL);
+  g_ptr_array_add (values, NULL);
+  job->keys   = (gchar **) g_ptr_array_free (names, FALSE);
+  job->values = (gchar **) g_ptr_array_free (values, FALSE);
+
+  if (!job->output ||
+      (!job->input && !g_key_file_has_key (kf, group, "text", NULL)))
+    {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND,
+                   "[%s] needs output= and either text= or input=", group);
+      rock_job_free (job);
+      job = NULL;
+    }
+  else if (job->input && g_key_file_has_key (kf, group, "text", NULL))
+    {
+      /* Rock text renders its own text layer, the input would be ignored */
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                   "[%s] takes text= or input=, not both", group);
+      rock_job_free (job);
+      job = NULL;
+    }
+  else if (stray)
+    {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                   "[%s] keyframe %s needs frames=", group, stray);
+      rock_job_free (job);
+      job = NULL;
+    }
+  g_free (stray);
+
+  return job;
+}
+
+static const gchar *
+rock_job_lookup (const RockJob *job,
+                 const gchar   *name)
+{
+  gint i;
+
+  for (i = 0; job->keys[i]; i++)
+    {
+      gchar   *key   = g_strdelimit (g_strdup (job->keys[i]), "_", '-');
+      gboolean match = !strcmp (key, name);
+
+      g_free (key);
+      if (match)
+        return job->values[i];
+    }
+
+  return NULL;
+}
+
+typedef struct
+{
+  gint   frame;
+  gchar *value;
+} RockKeyframe;
+
+static gint
+compare_keyframes (gconstpointer a,
+                   gconstpointer b)
+{
+  return ((const RockKeyframe *) a)->frame - ((const RockKeyframe *) b)->frame;
+}
+
+static void
+clear_keyframe (gpointer data)
+{
+  g_free (((RockKeyframe *) data)->value);
+}
+
+/* The value of a property with keyframes (sorted by frame) at frame, as the
+ * string a manifest would hold. plain is its name= value or NULL.
+ */
+static gchar *
+rock_keyframe_value (GParamSpec  *pspec,
+                     const gchar *plain,
+                     GArray      *keyframes,
+                     gint         frame)
+{
+  RockKeyframe *prev = NULL;
+  RockKeyframe *next = NULL;
+  GType         type = G_PARAM_SPEC_VALUE_TYPE (pspec);
+  gdouble       t;
+  guint         i;
+
+  for (i = 0; i < keyframes->len; i++)
+    {
+      RockKeyframe *key = &g_array_index (keyframes, RockKeyframe, i);
+
+      if (key->frame <= frame)
+        prev = key;
+      else if (!next)
+        next = key;
+    }
+
+  if (!prev)
+    return g_strdup (plain ? plain : next->value);
+  if (!next)
+    return g_strdup (prev->value);
+
+  t = (gdouble) (frame - prev->frame) / (next->frame - prev->frame);
+
+  if (type == G_TYPE_DOUBLE)
+    {
+      gchar   buf[G_ASCII_DTOSTR_BUF_SIZE];
+      gdouble a = g_ascii_strtod (prev->value, NULL);
+      gdouble b = g_ascii_strtod (next->value, NULL);
+
+      return g_strdup (g_ascii_dtostr (buf, sizeof (buf), a + (b - a) * t));
+    }
+  else if (type == G_TYPE_INT || type == G_TYPE_UINT)
+    {
+      gdouble a = g_ascii_strtod (prev->value, NULL);
+      gdouble b = g_ascii_strtod (next->value, NULL);
+
+      return g_strdup_printf ("%.0f", floor (a + (b - a) * t + 0.5));
+    }
+  else if (type == GEGL_TYPE_COLOR)
+    {
+      GeglColor *ca = gegl_color_new (prev->value);
+      GeglColor *cb = gegl_color_new (next->value);
+      gdouble    a[4], b[4];
+      guchar     c[4];
+
+      /* Fade in sRGB, the way the colors were written down */
+      gegl_color_get_pixel (ca, babl_format ("R'G'B'A double"), a);
+      gegl_color_get_pixel (cb, babl_format ("R'G'B'A double"), b);
+      for (i = 0; i < 4; i++)
+        c[i] = (guchar) CLAMP (floor ((a[i] + (b[i] - a[i]) * t) * 255.0 + 0.5), 0, 255);
+
+      g_object_unref (ca);
+      g_object_unref (cb);
+      return g_strdup_printf ("#%02x%02x%02x%02x", c[0], c[1], c[2], c[3]);
+    }
+
+  return g_strdup (prev->value);
+}
+
+/* An entry with frames=N stands for one job per frame, with the keyframed
+ * properties interpolated. Every frame is tagged with the first stage of
+ * rock text that differs from the frame before it.
+ */
+static GList *
+rock_jobs_from_timeline (GKeyFile     *kf,
+                         const gchar  *group,
+                         RockJob      *base,
+                         GError      **error)
+{
+  GHashTable *tracks;
+  GPtrArray  *names;
+  GList      *jobs = NULL;
+  gchar     **keys;
+  gchar     **last;
+  gint        n_frames, frame;
+  gsize       n_keys, i;
+  gboolean    ok = TRUE;
+
+  n_frames = g_key_file_get_integer (kf, group, "frames", error);
+  if (n_frames < 1)
+    {
+      if (error && !*error)
+        g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                     "[%s] frames= needs at least 1", group);
+      return NULL;
+    }
+
+  tracks = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                  (GDestroyNotify) g_array_unref);
+  names  = g_ptr_array_new ();
+
+  keys = g_key_file_get_keys (kf, group, &n_keys, NULL);
+  for (i = 0; i < n_keys && ok; i++)
+    {
+      const gchar  *at = strchr (keys[i], '@');
+      gchar        *end;
+      gchar        *name;
+      GArray       *track;
+      RockKeyframe  key;
+
+      if (!at)
+        continue;
+
+      key.frame = (gint) g_ascii_strtoll (at + 1, &end, 10);
+      name      = g_strdelimit (g_strndup (keys[i], at - keys[i]), "_", '-');
+
+      if (*end || end == at + 1 || key.frame < 0 || key.frame >= n_frames ||
+          !gegl_operation_find_property (ROCK_TEXT_OP, name))
+        {
+          g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                       "[%s] %s is not a keyframe of a %s property inside frames 0 to %d",
+                       group, keys[i], ROCK_TEXT_OP, n_frames - 1);
+          g_free (name);
+          ok = FALSE;
+          break;
+        }
+
+      track = g_hash_table_lookup (tracks, name);
+      if (!track)
+        {
+          track = g_array_new (FALSE, FALSE, sizeof (RockKeyframe));
+          g_array_set_clear_func (track, clear_keyframe);
+          g_hash_table_insert (tracks, name, track);
+          g_ptr_array_add (names, name);
+        }
+      else
+        {
+          g_free (name);
+        }
+
+      key.value = g_key_file_get_string (kf, group, keys[i], NULL);
+      g_array_append_val (track, key);
+    }
+  g_strfreev (keys);
+
+  last = g_new0 (gchar *, names->len + 1);
+
+  for (frame = 0; frame < n_frames && ok; frame++)
+    {
+      RockJob   *job    = g_new0 (RockJob, 1);
+      GPtrArray *jnames = g_ptr_array_new ();
+      GPtrArray *values = g_ptr_array_new ();
+      gchar     *tag    = g_strdup_printf ("%05d", frame);
+      guint      k;
+
+      job->name      = g_strdup_printf ("%s/%d", base->name, frame);
+      job->family    = g_strdup (base->name);
+      job->input     = g_strdup (base->input);
+      job->output    = rock_output_with_tag (base->output, "{frame}", tag);
+      job->budget_ms = base->budget_ms;
+      job->memory_mb = base->memory_mb;
+      job->animated  = TRUE;
+      job->frame     = frame;
+      job->stage     = frame ? ROCK_STAGE_NONE : ROCK_STAGE_TEXT;
+      g_free (tag);
+
+      for (k = 0; base->keys[k]; k++)
+        {
+          gchar   *name    = g_strdelimit (g_strdup (base->keys[k]), "_", '-');
+          gboolean tracked = g_hash_table_contains (tracks, name);
+
+          g_free (name);
+          if (tracked)
+            continue;
+
+          g_ptr_array_add (jnames, g_strdup (base->keys[k]));
+          g_ptr_array_add (values, g_strdup (base->values[k]));
+        }
+
+      for (k = 0; k < names->len; k++)
+        {
+          const gchar *name  = g_ptr_array_index (names, k);
+          GArray      *track = g_hash_table_lookup (tracks, name);
+          gchar       *value;
+
+          if (frame == 0)
+            g_array_sort (track, compare_keyframes);
+
+          value = rock_keyframe_value (gegl_operation_find_property (ROCK_TEXT_OP, name),
+                                       rock_job_lookup (base, name), track, frame);
+
+          if (frame > 0 && strcmp (value, last[k]))
+            job->stage = MIN (job->stage, rock_stage_of_property (name));
+
+          g_free (last[k]);
+          last[k] = g_strdup (value);
+
+          g_ptr_array_add (jnames, g_strdup (name));
+          g_ptr_array_add (values, value);
+        }
+
+      g_ptr_array_add (jnames, NULL);
+      g_ptr_array_add (values, NULL);
+      job->keys   = (gchar **) g_ptr_array_free (jnames, FALSE);
+      job->values = (gchar **) g_ptr_array_free (values, FALSE);
+
+      jobs = g_list_prepend (jobs, job);
+    }
+
+  g_strfreev (last);
+  g_ptr_array_free (names, TRUE);
+  g_hash_table_destroy (tracks);
+
+  if (!ok)
+    {
+      g_list_free_full (jobs, (GDestroyNotify) rock_job_free);
+      return NULL;
+    }
+
+  return g_list_reverse (jobs);
+}
+
+/* An entry with seeds=1,2,3 (and optionally seeds2=) stands for one variant
+ * per seed that only differ in seed and seed2.
+ */
+static GList *
+rock_jobs_from_group (GKeyFile     *kf,
+                      const gchar  *group,
+                      GError      **error)
+{
+  RockJob *base = rock_job_from_group (kf, group, error);
+  GList   *jobs = NULL;
+  gint    *seeds, *seeds2 = NULL;
+  gsize    n_seeds, n_seeds2 = 0, i;
+
+  if (!base)
+    return NULL;
+
+  if (g_key_file_has_key (kf, group, "frames", NULL))
+    {
+      if (g_key_file_has_key (kf, group, "seeds", NULL))
+        g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                     "[%s] can not have both frames= and seeds=, use seed@F= keyframes", group);
+      else
+        jobs = rock_jobs_from_timeline (kf, group, base, error);
+
+      rock_job_free (base);
+      return jobs;
+    }
+
+  if (!g_key_file_has_key (kf, group, "seeds", NULL))
+    return g_list_prepend (NULL, base);
+
+  seeds = g_key_file_get_integer_list (kf, group, "seeds", &n_seeds, error);
+  if (seeds && g_key_file_has_key (kf, group, "seeds2", NULL))
+    {
+      seeds2 = g_key_file_get_integer_list (kf, group, "seeds2", &n_seeds2, error);
+      if (seeds2 && n_seeds2 != n_seeds)
+        {
+          g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                       "[%s] seeds2= needs as many values as seeds=", group);
+          g_clear_pointer (&seeds, g_free);
+        }
+      else if (!seeds2)
+        {
+          g_clear_pointer (&seeds, g_free);
+        }
+    }
+
+  if (seeds)
+    for (i = 0; i < n_seeds; i++)
+      jobs = g_list_prepend (jobs,
+                             rock_job_new_variant (base, seeds[i],
+                                                   seeds2 != NULL,
+                                                   seeds2 ? seeds2[i] : 0));
+
+  g_free (seeds);
+  g_free (seeds2);
+  rock_job_free (base);
+
+  return g_list_reverse (jobs);
+}
+
+static GList *
+rock_jobs_from_key_file (GKeyFile  *kf,
+                         GError   **error)
+{
+  GList  *jobs = NULL;
+  gchar **groups;
+  gsize   n_groups, i;
+
+  groups = g_key_file_get_groups (kf, &n_groups);
+  for (i = 0; i < n_groups; i++)
+    {
+      GList *group_jobs = rock_jobs_from_group (kf, groups[i], error);
+
+      if (!group_jobs)
+        {
+          g_list_free_full (jobs, (GDestroyNotify) rock_job_free);
+          jobs = NULL;
+          break;
+        }
+      jobs = g_list_concat (jobs, group_jobs);
+    }
+
+  g_strfreev (groups);
+
+  return jobs;
+}
+
+GList *
+rock_job_load_manifest (const gchar  *path,
+                        GError      **error)
+{
+  GKeyFile *kf = g_key_file_new ();
+  GList    *jobs = NULL;
+
+  g_key_file_set_list_separator (kf, ',');
+
+  if (g_key_file_load_from_file (kf, path, G_KEY_FILE_NONE, error))
+    jobs = rock_jobs_from_key_file (kf, error);
+
+  g_key_file_free (kf);
+
+  return jobs;
+}
+
+GList *
+rock_job_load_data (const gchar  *data,
+                    gsize         length,
+                    GError      **error)
+{
+  GKeyFile *kf = g_key_file_new ();
+  GList    *jobs = NULL;
+
+  g_key_file_set_list_separator (kf, ',');
+
+  if (g_key_file_load_from_data (kf, data, length, G_KEY_FILE_NONE, error))
+    jobs = rock_jobs_from_key_file (kf, error);
+
+  g_key_file_free (kf);
+
+  return jobs;
+}
+
+/* Converts a manifest string to the type of the lb:rock-text property. */
+static gboolean
+parse_rock_value (GParamSpec   *pspec,
+                  const gchar  *string,
+                  GValue       *value,
+                  GError      **error)
+{
+  GType type = G_PARAM_SPEC_VALUE_TYPE (pspec);
+
+  if (type == G_TYPE_INT)
+    g_value_set_int (value, (gint) g_ascii_strtoll (string, NULL, 10));
+  else if (type == G_TYPE_UINT)
+    g_value_set_uint (value, (guint) g_ascii_strtoull (string, NULL, 10));
+  else if (type == G_TYPE_DOUBLE)
+    g_value_set_double (value, g_ascii_strtod (string, NULL));
+  else if (type == G_TYPE_BOOLEAN)
+    g_value_set_boolean (value, !g_ascii_strcasecmp (string, "true") ||
+                                !strcmp (string, "1"));
+  else if (type == G_TYPE_STRING)
+    g_value_set_string (value, string);
+  else if (type == GEGL_TYPE_COLOR)
+    g_value_take_object (value, gegl_color_new (string));
+  else if (G_TYPE_IS_ENUM (type))
+    {
+      GEnumClass *klass = g_type_class_ref (type);
+      GEnumValue *ev    = g_enum_get_value_by_nick (klass, string);
+
+      if (!ev)
+        ev = g_enum_get_value_by_name (klass, string);
+      if (ev)
+        g_value_set_enum (value, ev->value);
+      g_type_class_unref (klass);
+
+      if (!ev)
+        {
+          g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                       "%s is not a valid value for %s", string, pspec->name);
+          return FALSE;
+        }
+    }
+  else
+    {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                   "property %s of type %s can not be set from a manifest",
+                   pspec->name, g_type_name (type));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+gboolean
+rock_job_property_value (const RockJob *job,
+                         GParamSpec    *pspec,
+                         GValue        *value,
+                         GError       **error)
+{
+  const gchar *string = rock_job_lookup (job, pspec->name);
+
+  if (string)
+    return parse_rock_value (pspec, string, value, error);
+
+  g_param_value_set_default (pspec, value);
+  return TRUE;
+}
+
+static gboolean
+rock_values_equal (GParamSpec   *pspec,
+                   const GValue *a,
+                   const GValue *b)
+{
+  if (G_PARAM_SPEC_VALUE_TYPE (pspec) == GEGL_TYPE_COLOR)
+    {
+      GeglColor *ca = g_value_get_object (a);
+      GeglColor *cb = g_value_get_object (b);
+      gdouble    ra[4] = { 0, }, rb[4] = { 0, };
+
+      if (!ca || !cb)
+        return ca == cb;
+
+      gegl_color_get_rgba (ca, &ra[0], &ra[1], &ra[2], &ra[3]);
+      gegl_color_get_rgba (cb, &rb[0], &rb[1], &rb[2], &rb[3]);
+      return !memcmp (ra, rb, sizeof (ra));
+    }
+
+  return g_param_values_cmp (pspec, a, b) == 0;
+}
+
+/* Brings every lb:rock-text property to the value the job asks for, or to
+ * its default when the job does not mention it, so nothing leaks over from
+ * the previous job. Properties that already hold the wanted value are left
+ * alone; setting them would throw away cached results inside the op.
+ */
+static gboolean
+apply_rock_properties (GeglNode      *node,
+                       const RockJob *job,
+                       GError       **error)
+{
+  GParamSpec **pspecs;
+  guint        n_pspecs, i;
+  gboolean     ok = TRUE;
+
+  for (i = 0; job->keys[i]; i++)
+    {
+      gchar *name = g_strdelimit (g_strdup (job->keys[i]), "_", '-');
+
+      if (!gegl_operation_find_property (ROCK_TEXT_OP, name))
+        {
+          g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                       "%s has no property %s", ROCK_TEXT_OP, job->keys[i]);
+          g_free (name);
+          return FALSE;
+        }
+      g_free (name);
+    }
+
+  pspecs = gegl_operation_list_properties (ROCK_TEXT_OP, &n_pspecs);
+
+  for (i = 0; i < n_pspecs && ok; i++)
+    {
+      GParamSpec  *pspec   = pspecs[i];
+      GValue       wanted  = G_VALUE_INIT;
+      GValue       current = G_VALUE_INIT;
+
+      g_value_init (&wanted, G_PARAM_SPEC_VALUE_TYPE (pspec));
+      g_value_init (&current, G_PARAM_SPEC_VALUE_TYPE (pspec));
+
+      ok = rock_job_property_value (job, pspec, &wanted, error);
+      if (ok)
+        {
+          gegl_node_get_property (node, pspec->name, &current);
+          if (!rock_values_equal (pspec, &wanted, &current))
+            gegl_node_set_property (node, pspec->name, &wanted);
+        }
+
+      g_value_unset (&wanted);
+      g_value_unset (&current);
+    }
+
+  g_free (pspecs);
+  return ok;
+}
+
+/* Meta ops like gegl:dropshadow and lb:edgesmooth have graphs of their own */
+static void
+set_dont_cache (GeglNode *node)
+{
+  GSList *children = gegl_node_get_children (node);
+  GSList *iter;
+
+  for (iter = children; iter; iter = iter->next)
+    {
+      gegl_node_set (iter->data, "dont-cache", TRUE, NULL);
+      set_dont_cache (iter->data);
+    }
+
+  g_slist_free (children);
+}
+
+RockGraph *
+rock_graph_new (gboolean streaming)
+{
+  RockGraph *rg = g_new0 (RockGraph, 1);
+
+  rg->streaming = streaming;
+  rg->bounded   = streaming;
+  rg->graph = gegl_node_new ();
+  rg->load  = gegl_node_new_child (rg->graph,
+                                   "operation", "gegl:load",
+                                   NULL);
+  /* dont-cache goes first, rock text looks at it to skip its prefix cache */
+  rg->rock  = gegl_node_new_child (rg->graph,
+                                   "dont-cache", streaming,
+                                   "operation", ROCK_TEXT_OP,
+                                   NULL);
+  rg->crop  = gegl_node_new_child (rg->graph,
+                                   "operation", "gegl:crop",
+                                   NULL);
+  /* Saves results that are already rendered, see rock-cache.c */
+  rg->source = gegl_node_new_child (rg->graph,
+                                    "operation", "gegl:buffer-source",
+                                    NULL);
+  rg->save  = gegl_node_new_child (rg->graph,
+                                   "operation", "gegl:save",
+                                   NULL);
+
+  gegl_node_link (rg->rock, rg->save);
+
+  if (streaming)
+    set_dont_cache (rg->rock);
+
+  return rg;
+}
+
+void
+rock_graph_free (RockGraph *rg)
+{
+  if (!rg)
+    return;
+
+  g_object_unref (rg->graph);
+  g_free (rg);
+}
+
+gboolean
+rock_graph_apply (RockGraph     *rg,
+                  const RockJob *job,
+                  GError       **error)
+{
+  if (job->input)
+    {
+      gegl_node_set (rg->load, "path", job->input, NULL);
+      gegl_node_link (rg->load, rg->rock);
+    }
+  else
+    {
+      /* text= is handled by rock textꞌs own text mode */
+      gegl_node_disconnect (rg->rock, "input");
+    }
+
+  if (!apply_rock_properties (rg->rock, job, error))
+    return FALSE;
+
+  /* The IIR gaussian would pull whole columns into every band or shard */
+  if (rg->bounded)
+    gegl_node_set (rg->rock, "bounded-reach", TRUE, NULL);
+
+  gegl_node_set (rg->save, "path", job->output, NULL);
+  return TRUE;
+}
+
+void
+rock_graph_shard_region (RockGraph     *rg,
+                         gint           shard,
+                         gint           n_shards,
+                         GeglRectangle *region)
+{
+  GeglRectangle bounds = gegl_node_get_bounding_box (rg->rock);
+  gint          y0     = bounds.y + (gint) ((gint64) bounds.height * shard / n_shards);
+  gint          y1     = bounds.y + (gint) ((gint64) bounds.height * (shard + 1) / n_shards);
+
+  gegl_rectangle_set (region, bounds.x, y0, bounds.width, y1 - y0);
+}
+
+gboolean
+rock_graph_save (RockGraph *rg,
+                 GError   **error)
+{
+  gchar   *path;
+  gboolean ok;
+
+  /* gegl:save does not report errors, a file that is not there is one */
+  gegl_node_get (rg->save, "path", &path, NULL);
+  g_remove (path);
+  gegl_node_process (rg->save);
+  ok = g_file_test (path, G_FILE_TEST_EXISTS);
+  if (!ok)
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                 "%s: could not be written", path);
+  g_free (path);
+
+  return ok;
+}
+
+gboolean
+rock_graph_render (RockGraph           *rg,
+                   const RockJob       *job,
+                   const GeglRectangle *region,
+                   const gchar         *output,
+                   GError             **error)
+{
+  if (output)
+    gegl_node_set (rg->save, "path", output, NULL);
+
+  if (region)
+    {
+      gegl_node_set (rg->crop,
+                     "x",      (gdouble) region->x,
+                     "y",      (gdouble) region->y,
+                     "width",  (gdouble) region->width,
+                     "height", (gdouble) region->height,
+                     NULL);
+      gegl_node_link_many (rg->rock, rg->crop, rg->save, NULL);
+    }
+  else
+    {
+      gegl_node_link (rg->rock, rg->save);
+    }
+
+  return rock_graph_save (rg, error);
+}
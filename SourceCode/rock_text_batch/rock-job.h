@@ -0,0 +1,270 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+#pragma once
+
+#include <gegl.h>
+
+G_BEGIN_DECLS
+
+/* One entry of a render manifest. A manifest is a key file where every
+ * group is one title card:
+ *
+ * [card-001]
+ * text=Hello
+ * font=Sans Bold
+ * font-size=120
+ * output=out/card-001.png
+ * mvalue=#9a7143
+ * seed=12
+ * rockblend=multiply
+ * src=/path/to/overlay.png
+ *
+ * input and output describe the job itself, every other key is set on
+ * lb:rock-text as a property of the same name; text, font and font-size use
+ * rock textꞌs own text mode. Use input= instead of text= to start from an
+ * existing text layer image; an entry with both is rejected.
+ *
+ * seeds=1,2,3 (and optionally seeds2=) turns an entry into one variant per
+ * seed, written to output with the seed put in place of {seed} or before
+ * the extension.
+ *
+ * budget-ms=250 is the wall time the entry should render in, checked by
+ * rock-text-batch --reference.
+ *
+ * memory-mb=512 caps the memory of the entry, rock-text-batch picks how to
+ * render it to stay under the cap (see rock_graph_plan_memory). It overrides
+ * rock-text-batch --memory-budget.
+ *
+ * frames=120 turns an entry into an animation of 120 frames, written to
+ * output with the frame number put in place of {frame} or before the
+ * extension. A key written as name@F=value is a keyframe of that property
+ * at frame F (counting from 0); between keyframes numbers and colors are
+ * interpolated linearly, everything else keeps the value of the keyframe
+ * before. Without a keyframe before it a frame uses name=, or else the
+ * first keyframe.
+ *
+ * [intro]
+ * text=Rock
+ * frames=120
+ * output=frames/intro-{frame}.png
+ * azimuth@0=0
+ * azimuth@119=360
+ */
+
+/* The stages of the rock text chain, in order. A frame of an animation only
+ * has to run rock text again from the first stage whose properties differ
+ * from the frame before it, the nodes in front of that keep their caches.
+ */
+typedef enum
+{
+  ROCK_STAGE_TEXT,    /* text layer and first median */
+  ROCK_STAGE_SHAPE,   /* noise spread, gaussian, shift, second median */
+  ROCK_STAGE_LIGHT,   /* emboss or distance bevel and its blend */
+  ROCK_STAGE_FINISH,  /* colors, overlay, outline, grains, exposure */
+  ROCK_STAGE_NONE     /* same as the frame before */
+} RockStage;
+
+typedef struct
+{
+  gchar    *name;
+  gchar    *family;
+  gchar    *input;
+  gchar    *output;
+  gdouble   budget_ms;
+  gint      memory_mb;
+  gchar   **keys;
+  gchar   **values;
+  gboolean  animated;
+  gint      frame;
+  RockStage stage;
+} RockJob;
+
+/* A pre-built source -> lb:rock-text -> save graph that is reused for many
+ * jobs. Only properties change between jobs, so nodes are never rebuilt.
+ *
+ * A streaming graph is meant for rock_graph_render_bands: none of the nodes
+ * inside rock text, nor inside the meta ops it uses, keep a cache, and rock text always has a bounded reach,
+ * so every band only computes itself and its border.
+ *
+ * bounded forces rock textꞌs bounded-reach property on every job, so that a
+ * part of the result only reads a fixed border around itself. It is set for
+ * streaming graphs and by the batch tool for shards and memory budgets.
+ */
+typedef struct
+{
+  GeglNode *graph;
+  GeglNode *load;
+  GeglNode *rock;
+  GeglNode *crop;
+  GeglNode *source;
+  GeglNode *save;
+  gboolean  streaming;
+  gboolean  bounded;
+} RockGraph;
+
+GList     *rock_job_load_manifest (const gchar  *path,
+                                   GError      **error);
+/* Same as rock_job_load_manifest, for a manifest held in memory */
+GList     *rock_job_load_data     (const gchar  *data,
+                                   gsize         length,
+                                   GError      **error);
+void       rock_job_free          (RockJob      *job);
+/* A copy of job with the property name set to value and written to output */
+RockJob   *rock_job_with_property (const RockJob *job,
+                                   const gchar  *name,
+                                   const gchar  *value,
+                                   const gchar  *output);
+/* Sets value, initialized to the type of pspec, to what job gives the
+ * lb:rock-text property pspec, or to its default when job does not set it.
+ */
+gboolean   rock_job_property_value (const RockJob *job,
+                                    GParamSpec    *pspec,
+                                    GValue        *value,
+                                    GError       **error);
+
+/* The stage of rock text a property of lb:rock-text feeds, and its name */
+RockStage    rock_stage_of_property (const gchar *name);
+const gchar *rock_stage_name        (RockStage    stage);
+
+/* Puts tag into an output path where placeholder is written, or right
+ * before the extension.
+ */
+gchar     *rock_output_with_tag   (const gchar  *output,
+                                   const gchar  *placeholder,
+                                   const gchar  *tag);
+
+RockGraph *rock_graph_new         (gboolean      streaming);
+void       rock_graph_free        (RockGraph    *rg);
+gboolean   rock_graph_apply       (RockGraph    *rg,
+                                   const RockJob *job,
+                                   GError      **error);
+
+/* The rows of strip shard out of n_shards equal horizontal strips of the
+ * result, call after rock_graph_apply.
+ */
+void       rock_graph_shard_region (RockGraph    *rg,
+                                    gint          shard,
+                                    gint          n_shards,
+                                    GeglRectangle *region);
+
+/* Processes the save node of rg, whatever is linked to it, and fails when
+ * its file was not written.
+ */
+gboolean   rock_graph_save        (RockGraph    *rg,
+                                   GError      **error);
+
+/* Renders the job, only the part inside region when it is not NULL, and
+ * saves it to output, or to the jobꞌs output when output is NULL. Call
+ * after rock_graph_apply, like every rock_graph_render_* below.
+ */
+gboolean   rock_graph_render      (RockGraph    *rg,
+                                   const RockJob *job,
+                                   const GeglRectangle *region,
+                                   const gchar  *output,
+                                   GError      **error);
+
+/* How far rock text reaches with the current properties: how many rows
+ * above and below a band it reads, and how far a change of the input can
+ * move the result. The sum of the reach of every stage of the chain, exact
+ * with bounded-reach (the IIR gaussian reaches further, by tiny amounts).
+ * Call after rock_graph_apply.
+ */
+gint       rock_graph_reach       (RockGraph    *rg);
+
+/* Updates an earlier render of the job after its input changed only inside
+ * dirty: only dirty grown by rock_graph_reach is rendered again and pasted
+ * into the existing output (or the jobꞌs output when output is NULL). When
+ * there is no earlier output, or the size of the result changed, it is
+ * rendered in full. rendered is set to the area that was rendered.
+ */
+gboolean   rock_graph_render_dirty (RockGraph   *rg,
+                                    const RockJob *job,
+                                    const GeglRectangle *dirty,
+                                    const gchar *output,
+                                    GeglRectangle *rendered,
+                                    GError     **error);
+
+/* Renders the job band by band, band_height rows at a time, and writes
+ * every band to output (or the jobꞌs output) as soon as it is done. Peak
+ * memory follows band_height instead of the canvas size. Needs a streaming
+ * graph, with the job applied, and a .png output.
+ */
+gboolean   rock_graph_render_bands (RockGraph   *rg,
+                                    const RockJob *job,
+                                    const GeglRectangle *region,
+                                    const gchar *output,
+                                    gint         band_height,
+                                    GError     **error);
+
+/* Appends every link inside rock text with the format on both ends to
+ * trace, and returns how many of them convert pixels. Call after a render.
+ */
+guint      rock_graph_trace_formats (RockGraph *rg,
+                                     GString   *trace);
+
+/* How a job is rendered to stay within a memory budget */
+typedef enum
+{
+  ROCK_MEMORY_FULL,       /* every node keeps its cache */
+  ROCK_MEMORY_RECOMPUTE,  /* a streaming graph, areas asked for twice are computed twice */
+  ROCK_MEMORY_BANDS       /* a streaming graph rendered with rock_graph_render_bands */
+} RockMemoryStrategy;
+
+typedef struct
+{
+  RockMemoryStrategy strategy;
+  guint64            budget;
+  guint64            estimate;     /* bytes the strategy should peak at */
+  gint               band_height;  /* rows of a band, for ROCK_MEMORY_BANDS */
+  gboolean           fits;         /* FALSE when not even the smallest bands fit */
+} RockMemoryPlan;
+
+/* Picks the fastest strategy whose estimated peak fits in budget bytes, from
+ * the bounding boxes and formats of the nodes of rg, which has to be a graph
+ * with caches, after rock_graph_apply. Bands are only picked for a .png
+ * output (output, or the jobꞌs output when output is NULL). When report is
+ * not NULL, appends the estimated peak of every child of rock text in MiB,
+the same estimates the strategy is picked from, not measurements.
+ */
+void         rock_graph_plan_memory    (RockGraph          *rg,
+                                        guint64             budget,
+                                        const gchar        *output,
+                                        RockMemoryPlan     *plan,
+                                        GString            *report);
+const gchar *rock_memory_strategy_name (RockMemoryStrategy  strategy);
+
+/* Writes finished frames of an animation on threads of its own, so the
+ * render threads go on with the next frame while PNG encoding and disk
+ * writes of the last one run. At most max_pending frames wait at a time,
+ * rock_graph_render_frame blocks before rendering until there is room.
+ */
+typedef struct _RockFrameWriter RockFrameWriter;
+
+RockFrameWriter *rock_frame_writer_new  (gint             n_threads,
+                                         gint             max_pending);
+/* Renders the job (after rock_graph_apply) into a buffer and queues it */
+gboolean         rock_graph_render_frame (RockGraph      *rg,
+                                          const RockJob  *job,
+                                          RockFrameWriter *writer,
+                                          GError        **error);
+/* Waits for every queued frame, returns how many could not be written */
+guint            rock_frame_writer_free (RockFrameWriter *writer);
+
+G_END_DECLS
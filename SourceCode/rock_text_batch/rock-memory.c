@@ -0,0 +1,309 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Memory budgets. The chain of rock text is walked back from its output, and every node that makes a buffer
+of its own is counted with its bounding box and the bytes per pixel of the format prepare() gave it. Point
+ops write in place and nops pass their input on, so they do not count. From that the cheapest way to render
+within the budget is picked: with every cache, with no caches (an area asked for twice is computed twice),
+or with no caches in bands of as many rows as fit.
+ */
+
+#include <string.h>
+#include <gegl-plugin.h>
+#include "rock-job.h"
+
+typedef struct
+{
+  const gchar *operation;
+  const gchar *label;
+} ChildLabel;
+
+/* The names the report uses for the children of rock text */
+static const ChildLabel child_labels[] =
+{
+  { "gegl:median-blur",   "median"     },
+  { "lb:rock-median",     "median"     },
+  { "gegl:noise-spread",  "noise"      },
+  { "lb:rock-spread",     "noise"      },
+  { "gegl:gaussian-blur", "gaussian"   },
+  { "gegl:box-blur",      "gaussian"   },
+  { "gegl:emboss",        "emboss"     },
+  { "lb:rock-bevel",      "emboss"     },
+  { "lb:rock-outline",    "outline"    },
+  { "gegl:dropshadow",    "outline"    },
+  { "lb:edgesmooth",      "edgesmooth" },
+};
+
+/* These never hold pixels of their own */
+static const gchar *passthrough[] =
+{
+  "gegl:nop", "gegl:clone", "gegl:crop", "gegl:buffer-sink",
+};
+
+typedef struct
+{
+  const gchar *label;
+  guint64      bytes;
+} ChildBytes;
+
+typedef struct
+{
+  GeglNode   *rock;
+  GHashTable *seen;
+  GArray     *children;  /* ChildBytes, in the order they are met */
+  guint64     largest;   /* the largest buffer of one node */
+  gint        bpp;       /* the most bytes per pixel of any buffer */
+} MemoryWalk;
+
+static const gchar *
+child_label (GeglNode *node)
+{
+  const gchar *operation = gegl_node_get_operation (node);
+  guint        i;
+
+  for (i = 0; i < G_N_ELEMENTS (child_labels); i++)
+    if (!g_strcmp0 (child_labels[i].operation, operation))
+      return child_labels[i].label;
+
+  return operation;
+}
+
+static guint64
+node_bytes (GeglNode *node,
+            gint     *bpp)
+{
+  GeglOperation *operation = gegl_node_get_gegl_operation (node);
+  const gchar   *name      = gegl_node_get_operation (node);
+  const Babl    *format;
+  GeglRectangle  bbox;
+  guint          i;
+
+  *bpp = 0;
+
+  if (!operation ||
+      GEGL_IS_OPERATION_POINT_FILTER (operation) ||
+      GEGL_IS_OPERATION_POINT_COMPOSER (operation) ||
+      GEGL_IS_OPERATION_POINT_COMPOSER3 (operation))
+    return 0;
+
+  for (i = 0; i < G_N_ELEMENTS (passthrough); i++)
+    if (!g_strcmp0 (passthrough[i], name))
+      return 0;
+
+  bbox = gegl_node_get_bounding_box (node);
+  if (gegl_rectangle_is_empty (&bbox) || gegl_rectangle_is_infinite_plane (&bbox))
+    return 0;
+
+  format = gegl_operation_get_format (operation, "output");
+  *bpp   = format ? babl_format_get_bytes_per_pixel (format) : 16;
+
+  return (guint64) bbox.width * bbox.height * *bpp;
+}
+
+static void
+add_bytes (MemoryWalk  *walk,
+           const gchar *label,
+           guint64      bytes)
+{
+  guint i;
+
+  for (i = 0; i < walk->children->len; i++)
+    {
+      ChildBytes *child = &g_array_index (walk->children, ChildBytes, i);
+
+      if (!strcmp (child->label, label))
+        {
+          child->bytes += bytes;
+          return;
+        }
+    }
+
+  g_array_append_vals (walk->children, &(ChildBytes) { label, bytes }, 1);
+}
+
+static void
+walk_node (MemoryWalk  *walk,
+           GeglNode    *node,
+           const gchar *label)
+{
+  static const gchar *pads[] = { "input", "aux", "aux2" };
+  GSList *children;
+  guint   i;
+
+  if (!node || g_hash_table_contains (walk->seen, node))
+    return;
+  g_hash_table_add (walk->seen, node);
+
+  /* Meta ops like lb:edgesmooth and gegl:gaussian-blur have a graph of their own */
+  children = gegl_node_get_children (node);
+  if (children)
+    {
+      GeglNode *proxy = gegl_node_get_output_proxy (node, "output");
+
+      walk_node (walk, gegl_node_get_producer (proxy, "input", NULL), label);
+    }
+  else
+    {
+      gint    bpp;
+      guint64 bytes = node_bytes (node, &bpp);
+
+      if (bytes)
+        {
+          add_bytes (walk, label, bytes);
+          walk->largest = MAX (walk->largest, bytes);
+          walk->bpp     = MAX (walk->bpp, bpp);
+        }
+    }
+  g_slist_free (children);
+
+  for (i = 0; i < G_N_ELEMENTS (pads); i++)
+    {
+      GeglNode *producer;
+
+      if (!gegl_node_has_pad (node, pads[i]))
+        continue;
+
+      producer = gegl_node_get_producer (node, pads[i], NULL);
+      if (producer)
+        walk_node (walk, producer,
+                   gegl_node_get_parent (producer) == walk->rock ?
+                   child_label (producer) : label);
+    }
+}
+
+const gchar *
+rock_memory_strategy_name (RockMemoryStrategy strategy)
+{
+  switch (strategy)
+    {
+    case ROCK_MEMORY_FULL:      return "full";
+    case ROCK_MEMORY_RECOMPUTE: return "recompute";
+    case ROCK_MEMORY_BANDS:     return "bands";
+    }
+
+  return "?";
+}
+
+static void
+append_mib (GString     *report,
+            const gchar *label,
+            guint64      bytes)
+{
+  g_string_append_printf (report, "%s%s %.1f", report->len ? ", " : "",
+                          label, bytes / 1048576.0);
+}
+
+void
+rock_graph_plan_memory (RockGraph      *rg,
+                        guint64         budget,
+                        const gchar    *output,
+                        RockMemoryPlan *plan,
+                        GString        *report)
+{
+  MemoryWalk    walk  = { 0, };
+  GeglRectangle bbox  = gegl_node_get_bounding_box (rg->rock);
+  GeglNode     *proxy = gegl_node_get_output_proxy (rg->rock, "output");
+  GeglNode     *producer;
+  guint64       input = 0, held = 0, band_bytes;
+  gdouble       share = 1.0;
+  gchar        *path  = NULL;
+  gboolean      can_stream = FALSE;
+  gint          reach, bpp;
+  guint         i;
+
+  walk.rock     = rg->rock;
+  walk.seen     = g_hash_table_new (NULL, NULL);
+  walk.children = g_array_new (FALSE, FALSE, sizeof (ChildBytes));
+
+  producer = gegl_node_get_producer (proxy, "input", NULL);
+  if (producer)
+    walk_node (&walk, producer, child_label (producer));
+
+  /* The input layer stays loaded whatever the strategy */
+  if (gegl_node_get_producer (rg->rock, "input", NULL))
+    input = node_bytes (rg->load, &bpp);
+
+  for (i = 0; i < walk.children->len; i++)
+    held += g_array_index (walk.children, ChildBytes, i).bytes;
+
+  /* Bands are only written to PNG files, see rock_graph_render_bands */
+  if (output)
+    path = g_strdup (output);
+  else
+    gegl_node_get (rg->save, "path", &path, NULL);
+#ifdef HAVE_PNG
+  can_stream = path && (g_str_has_suffix (path, ".png") || g_str_has_suffix (path, ".PNG"));
+#endif
+  g_free (path);
+
+  reach      = rock_graph_reach (rg);
+  walk.bpp   = MAX (walk.bpp, 4);
+  band_bytes = (guint64) bbox.width * walk.bpp * 2;
+
+  plan->budget      = budget;
+  plan->band_height = 0;
+  plan->fits        = TRUE;
+
+  /* Every node keeps its result, plus the result on its way to the file */
+  plan->strategy = ROCK_MEMORY_FULL;
+  plan->estimate = input + held + walk.largest;
+
+  /* Without caches only a stage and the one it reads from are held at once */
+  if (plan->estimate > budget)
+    {
+      plan->strategy = ROCK_MEMORY_RECOMPUTE;
+      plan->estimate = input + 2 * walk.largest;
+    }
+
+  /* A band and its border in the two buffers of a stage, and its PNG rows */
+  if (plan->estimate > budget && bbox.height > 0 && can_stream)
+    {
+      gint64 rows = budget > input ?
+                    (gint64) ((budget - input) / (band_bytes + (guint64) bbox.width * 4)) - 2 * reach :
+                    0;
+
+      plan->strategy    = ROCK_MEMORY_BANDS;
+      plan->band_height = (gint) CLAMP (rows, MAX (16, reach), bbox.height);
+      plan->estimate    = input + band_bytes * (plan->band_height + 2 * reach) +
+                          (guint64) bbox.width * 4 * plan->band_height;
+      share = MIN ((gdouble) (plan->band_height + 2 * reach) / bbox.height, 1.0);
+    }
+
+  plan->fits = plan->estimate <= budget;
+
+  /* What every child is estimated to peak at: all of it when it is kept or
+   * computed at once, a band of it when streaming
+   */
+  if (report)
+    {
+      if (input)
+        append_mib (report, "input", input);
+      /* The walk went from the output back, the report goes along the chain */
+      for (i = walk.children->len; i-- > 0;)
+        {
+          ChildBytes *child = &g_array_index (walk.children, ChildBytes, i);
+
+          append_mib (report, child->label, (guint64) (child->bytes * share));
+        }
+    }
+
+  g_array_free (walk.children, TRUE);
+  g_hash_table_destroy (walk.seen);
+}
@@ -0,0 +1,1332 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Renders every entry of a manifest with lb:rock-text, without GIMP.
+
+rock-text-batch --threads 4 cards.ini
+
+Each worker thread builds one graph the first time it picks up a job and
+reuses it for every job after that. The variants of an entry with seeds= are
+split in one contiguous share per worker: inside a share only seed and seed2
+change, so the seed independent front of rock text (the text layer and the
+first median) is computed once per worker and only the seeded tails run in
+parallel. The format of the manifest is described
+in rock-job.h. The output format follows the extension of output= (png, exr,
+...), whatever gegl:save supports.
+
+rock-text-batch --band-height 0 poster.ini
+
+renders in horizontal bands and streams every band into the PNG file as soon
+as it is done, for canvases too large to keep in memory. 0 picks the band
+height from the combined reach of the rock text chain.
+
+rock-text-batch --cache-dir ~/.cache/rock-text --cache-size 2048 cards.ini
+
+keeps every result in an on disk cache (see rock-cache.h); a job that was
+rendered before, by this run or an earlier one, only saves the cached pixels.
+
+rock-text-batch --threads 1 --reference golden/ cases.ini
+
+checks every result against the image of the same name in golden/: it fails
+when one channel is further off than --tolerance, when the SSIM drops under
+--min-ssim, or when an entry with budget-ms= takes longer than its budget plus
+--budget-margin percent. Use one thread for stable timings.
+
+rock-text-batch --dirty 120,40,200,90 cards.ini
+
+updates results rendered before after the input layers changed only inside
+that rectangle: it and the reach of rock text around it are rendered again
+and pasted into the existing outputs. Updates always use bounded-reach=true,
+the reach is only exact then.
+
+rock-text-batch --trace-formats cards.ini
+
+prints every link inside rock text with the pixel format on both of its ends
+and counts the links where babl has to convert.
+
+rock-text-batch --threads 4 intro.ini
+
+with an entry that has frames= and name@F= keyframes (see rock-job.h) renders
+an image sequence. Every worker takes one contiguous run of frames and only
+sets the properties that moved since its last frame, so rock text reruns from
+the first stage that changed; frames are encoded and written by a pool of
+their own while the next frame renders.
+
+rock-text-batch --quality-report cards.ini
+
+renders every entry at final, normal and draft quality, one at a time, and
+prints how much faster normal and draft are and how far they are off the
+final result. Nothing is written to the outputs of the manifest.
+
+rock-text-batch --memory-budget 512 poster.ini
+
+renders every entry within 512 MiB (an entry with memory-mb= has a budget of
+its own): from the bounding boxes and formats inside rock text it picks a full
+render with every cache, a render without caches that computes again what is
+asked for twice, or bands of as many rows as fit, and prints the estimated
+peak of every child of rock text. Without caches and in bands rock text runs
+with bounded-reach=true, which the report says, so those jobs differ slightly
+from a render without a budget. The budget is per worker thread, --threads 1
+for big canvases.
+
+rock-text-batch --startup-benchmark
+
+prints how long gegl_init (finding and registering the GEGL plug-ins), building
+one graph and the first small render take, to compare the separate modules
+with the rock-text-bundle module. No manifest is needed.
+
+rock-text-batch --median-benchmark
+
+times gegl:median-blur against lb:rock-median on a large text layer for every
+radius from 1 to 10, and prints how far apart their results are. No manifest
+is needed.
+
+rock-text-batch --finish-check
+
+renders the tail of rock text on a grained text layer twice, once with the edge
+smoothing fused into lb:rock-finish and once with lb:rock-finish followed by
+lb:edgesmooth, prints both times and how far apart they are, and fails when
+they differ by more than rounding of the 8 bit medians. No manifest is needed.
+With --reference it also renders lb:edgesmooth on its own to edgesmooth.png
+and compares it with the reference image of that name.
+
+rock-text-batch --dirty-check
+
+renders a text layer with bounded-reach=true, changes a few letters of the
+layer, updates the render with --dirty's code path and fails unless the result
+has exactly the pixels of a full render of the changed layer. No manifest is
+needed.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "rock-job.h"
+#include "rock-cache.h"
+#include "rock-compare.h"
+
+static gint     n_threads = 0;
+static gboolean quiet     = FALSE;
+static gchar   *shard_arg = NULL;
+static gchar   *rect_arg  = NULL;
+static gchar   *dirty_arg = NULL;
+static gint     band_height = -1;
+static gchar   *cache_dir   = NULL;
+static gint     cache_size  = 2048;
+static gchar   *reference_dir = NULL;
+static gdouble  tolerance     = 0.01;
+static gdouble  min_ssim      = 0.98;
+static gdouble  budget_margin = 25.0;
+static gboolean trace_formats = FALSE;
+static gboolean startup_benchmark = FALSE;
+static gboolean median_benchmark  = FALSE;
+static gboolean finish_check      = FALSE;
+static gboolean dirty_check       = FALSE;
+static gboolean quality_report    = FALSE;
+static gint     memory_budget     = 0;
+
+static gint          shard    = 0;
+static gint          n_shards = 0;
+static GeglRectangle rect     = { 0, };
+static GeglRectangle dirty    = { 0, };
+
+static GOptionEntry entries[] =
+{
+  { "threads", 't', 0, G_OPTION_ARG_INT, &n_threads,
+    "Number of worker threads (default: number of processors)", "N" },
+  { "quiet", 'q', 0, G_OPTION_ARG_NONE, &quiet,
+    "Only print the summary", NULL },
+  { "shard", 's', 0, G_OPTION_ARG_STRING, &shard_arg,
+    "Only render horizontal strip I of N", "I/N" },
+  { "rect", 'r', 0, G_OPTION_ARG_STRING, &rect_arg,
+    "Only render this rectangle", "X,Y,W,H" },
+  { "dirty", 'd', 0, G_OPTION_ARG_STRING, &dirty_arg,
+    "Only the input inside this rectangle changed, update the existing outputs", "X,Y,W,H" },
+  { "band-height", 'b', 0, G_OPTION_ARG_INT, &band_height,
+    "Stream the result to a PNG in bands of N rows (0: from the reach of the effect)", "N" },
+  { "cache-dir", 'c', 0, G_OPTION_ARG_FILENAME, &cache_dir,
+    "Reuse and keep finished renders in this folder", "DIR" },
+  { "cache-size", 0, 0, G_OPTION_ARG_INT, &cache_size,
+    "Size limit of the render cache in MiB (default: 2048)", "MB" },
+  { "reference", 0, 0, G_OPTION_ARG_FILENAME, &reference_dir,
+    "Compare every result with the image of the same name in this folder", "DIR" },
+  { "tolerance", 0, 0, G_OPTION_ARG_DOUBLE, &tolerance,
+    "Largest difference of one channel allowed by --reference (default: 0.01)", "T" },
+  { "min-ssim", 0, 0, G_OPTION_ARG_DOUBLE, &min_ssim,
+    "Lowest SSIM allowed by --reference (default: 0.98)", "S" },
+  { "budget-margin", 0, 0, G_OPTION_ARG_DOUBLE, &budget_margin,
+    "Percent over budget-ms= allowed by --reference (default: 25)", "P" },
+  { "memory-budget", 'm', 0, G_OPTION_ARG_INT, &memory_budget,
+    "Render every job within MB MiB, picking caches, recomputation or bands", "MB" },
+  { "trace-formats", 0, 0, G_OPTION_ARG_NONE, &trace_formats,
+    "Print the pixel formats along rock text and where they are converted", NULL },
+  { "quality-report", 0, 0, G_OPTION_ARG_NONE, &quality_report,
+    "Compare the speed and the result of draft, normal and final quality, then quit", NULL },
+  { "startup-benchmark", 0, 0, G_OPTION_ARG_NONE, &startup_benchmark,
+    "Time GEGL start up, building a graph and a first render, then quit", NULL },
+  { "median-benchmark", 0, 0, G_OPTION_ARG_NONE, &median_benchmark,
+    "Time gegl:median-blur against lb:rock-median for radius 1 to 10, then quit", NULL },
+  { "finish-check", 0, 0, G_OPTION_ARG_NONE, &finish_check,
+    "Compare the edge smoothing of lb:rock-finish with lb:edgesmooth, then quit", NULL },
+  { "dirty-check", 0, 0, G_OPTION_ARG_NONE, &dirty_check,
+    "Check that a --dirty update gives the pixels of a full render, then quit", NULL },
+  { NULL }
+};
+
+typedef struct
+{
+  GMutex  mutex;
+  guint   done;
+  guint   failed;
+  guint   cache_hits;
+  gint64  busy_us;
+  guint   stages[ROCK_STAGE_NONE + 1];
+  guint   frames;
+  guint   strategies[ROCK_MEMORY_BANDS + 1];
+  guint   over_budget;
+} BatchStats;
+
+static BatchStats stats;
+static RockCache *cache;
+static GPrivate   worker_graph = G_PRIVATE_INIT (NULL);
+static GPrivate   worker_stream_graph = G_PRIVATE_INIT (NULL);
+static GPtrArray *all_graphs;
+static RockFrameWriter *frame_writer;
+
+/* Fails when the image at output drifted from the one of the same name in
+ * the reference folder
+ */
+static gboolean
+compare_reference (const gchar  *output,
+                   GError      **error)
+{
+  RockCompareResult result;
+  gchar            *basename  = g_path_get_basename (output);
+  gchar            *reference = g_build_filename (reference_dir, basename, NULL);
+  gboolean          ok;
+
+  ok = rock_compare_files (output, reference, &result, error);
+
+  if (ok && (result.max_diff > tolerance || result.ssim < min_ssim))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                   "differs from %s: max %.4f mean %.5f ssim %.4f",
+                   reference, result.max_diff, result.mean_diff, result.ssim);
+      ok = FALSE;
+    }
+
+  g_free (basename);
+  g_free (reference);
+
+  return ok;
+}
+
+/* Fails the job when its result or its time drifted from the reference */
+static gboolean
+check_reference (RockJob      *job,
+                 const gchar  *output,
+                 gint64        elapsed,
+                 GError      **error)
+{
+  gdouble  ms = elapsed / 1000.0;
+  gboolean ok;
+
+  ok = compare_reference (output, error);
+
+  if (ok && job->budget_ms > 0.0 &&
+      ms > job->budget_ms * (1.0 + budget_margin / 100.0))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                   "took %.1f ms, over its budget of %.1f ms + %.0f%%",
+                   ms, job->budget_ms, budget_margin);
+      ok = FALSE;
+    }
+
+  return ok;
+}
+
+/* This threadꞌs graph behind key, built the first time it is asked for */
+static RockGraph *
+thread_graph (GPrivate *key,
+              gboolean  streaming)
+{
+  RockGraph *rg = g_private_get (key);
+
+  if (!rg)
+    {
+      rg = rock_graph_new (streaming);
+      g_private_set (key, rg);
+
+      g_mutex_lock (&stats.mutex);
+      g_ptr_array_add (all_graphs, rg);
+      g_mutex_unlock (&stats.mutex);
+    }
+
+  return rg;
+}
+
+/* Plans the job on rg, which keeps caches and has the job applied, and
+ * renders it the way the plan says
+ */
+static gboolean
+render_within_budget (RockGraph           *rg,
+                      const RockJob       *job,
+                      const GeglRectangle *region,
+                      const gchar         *output,
+                      RockMemoryPlan      *plan,
+                      GString             *report,
+                      GError             **error)
+{
+  gint       mb = job->memory_mb > 0 ? job->memory_mb : memory_budget;
+  RockGraph *stream;
+
+  rock_graph_plan_memory (rg, (guint64) mb << 20, output, plan, report);
+
+  if (plan->strategy == ROCK_MEMORY_FULL)
+    return rock_graph_render (rg, job, region, output, error);
+
+  /* Only here is bounded-reach forced, a full render keeps the jobꞌs own */
+  stream = thread_graph (&worker_stream_graph, TRUE);
+  if (!rock_graph_apply (stream, job, error))
+    return FALSE;
+
+  if (plan->strategy == ROCK_MEMORY_RECOMPUTE)
+    return rock_graph_render (stream, job, region, output, error);
+
+  return rock_graph_render_bands (stream, job, region, output, plan->band_height, error);
+}
+
+static void
+render_one (RockGraph *rg,
+            RockJob   *job)
+{
+  GError        *error  = NULL;
+  gchar         *output = NULL;
+  GeglRectangle  region;
+  GeglRectangle *regionp = NULL;
+  gint64         start;
+  gint64         elapsed;
+  gint           rows = 0;
+  gboolean       hit  = FALSE;
+  gboolean       ok = TRUE;
+  RockMemoryPlan plan;
+  GString       *report = NULL;
+
+  start = g_get_monotonic_time ();
+
+  /* Each shard then only reads its own strip and a fixed halo, and a dirty
+   * update pastes a rectangle that is only exact within a bounded reach
+   */
+  rg->bounded = rg->streaming || n_shards > 0 || dirty_arg;
+  if (n_shards == 0 && rect.width > 0 && rect.height > 0)
+    {
+      region  = rect;
+      regionp = &region;
+    }
+
+  /* A cached result is saved without applying the job at all. A shard
+   * needs the applied graph to know its strip, so it looks up after.
+   */
+  if (cache && n_shards == 0)
+    ok = rock_cache_save_hit (cache, rg, job, regionp, NULL, &hit, &error);
+
+  /* Once per job, every way of rendering below works on the applied graph */
+  if (ok && !hit)
+    ok = rock_graph_apply (rg, job, &error);
+
+  if (ok && !hit && n_shards > 0)
+    {
+      gchar *tag = g_strdup_printf ("shard%d", shard);
+
+      output  = rock_output_with_tag (job->output, "{shard}", tag);
+      regionp = &region;
+      rock_graph_shard_region (rg, shard, n_shards, &region);
+      g_free (tag);
+
+      if (cache)
+        ok = rock_cache_save_hit (cache, rg, job, regionp, output, &hit, &error);
+    }
+
+  if (!ok || hit)
+    ;
+  else if (band_height >= 0)
+    {
+      /* Bands of 8 times the reach recompute at most a quarter of their rows */
+      rows = band_height > 0 ? band_height : MAX (64, 8 * rock_graph_reach (rg));
+      ok   = rock_graph_render_bands (rg, job, regionp, output, rows, &error);
+    }
+  else if (cache)
+    {
+      ok = rock_cache_render (cache, rg, job, regionp, output, &error);
+    }
+  else if (dirty_arg)
+    {
+      regionp = &region;
+      ok = rock_graph_render_dirty (rg, job, &dirty, output, &region, &error);
+    }
+  else if (job->memory_mb > 0 || memory_budget > 0)
+    {
+      report = g_string_new (NULL);
+      ok = render_within_budget (rg, job, regionp, output, &plan, report, &error);
+    }
+  else if (job->animated && frame_writer && !regionp && !reference_dir)
+    {
+      ok = rock_graph_render_frame (rg, job, frame_writer, &error);
+    }
+  else
+    {
+      ok = rock_graph_render (rg, job, regionp, output, &error);
+    }
+  elapsed = g_get_monotonic_time () - start;
+
+  if (ok && reference_dir)
+    ok = check_reference (job, output ? output : job->output, elapsed, &error);
+
+  g_mutex_lock (&stats.mutex);
+  stats.done++;
+  stats.busy_us += elapsed;
+  if (hit)
+    stats.cache_hits++;
+  if (job->animated)
+    {
+      stats.frames++;
+      stats.stages[job->stage]++;
+    }
+  if (ok && report)
+    {
+      stats.strategies[plan.strategy]++;
+      if (!plan.fits)
+        {
+          stats.over_budget++;
+          g_printerr ("%s: needs about %.1f MiB rendered as %s, over its budget of %.1f MiB\n",
+                      job->name, plan.estimate / 1048576.0,
+                      rock_memory_strategy_name (plan.strategy), plan.budget / 1048576.0);
+        }
+    }
+  if (!ok)
+    {
+      stats.failed++;
+      g_printerr ("%s: %s\n", job->name, error->message);
+    }
+  else if (!quiet && report)
+    {
+      g_print ("%-24s %9.1f ms  %s  (%s", job->name, elapsed / 1000.0,
+               output ? output : job->output, rock_memory_strategy_name (plan.strategy));
+      if (plan.strategy == ROCK_MEMORY_BANDS)
+        g_print (" of %d rows", plan.band_height);
+      /* The streaming graph is bounded, see render_within_budget */
+      if (plan.strategy != ROCK_MEMORY_FULL)
+        g_print (", with bounded-reach");
+      g_print (", about %.1f of %.1f MiB)\n%-24s estimated MiB: %s\n",
+               plan.estimate / 1048576.0, plan.budget / 1048576.0, "", report->str);
+    }
+  else if (!quiet && regionp)
+    {
+      g_print ("%-24s %9.1f ms  %s  (%d,%d %dx%d)\n", job->name, elapsed / 1000.0,
+               output ? output : job->output,
+               region.x, region.y, region.width, region.height);
+    }
+  else if (!quiet && rows)
+    {
+      g_print ("%-24s %9.1f ms  %s  (bands of %d rows)\n", job->name, elapsed / 1000.0,
+               job->output, rows);
+    }
+  else if (!quiet)
+    {
+      g_print ("%-24s %9.1f ms  %s%s%s%s\n", job->name, elapsed / 1000.0, job->output,
+               hit ? "  (cached)" : "",
+               job->animated ? "  " : "",
+               job->animated ? rock_stage_name (job->stage) : "");
+    }
+
+  /* A cache hit never ran rock text, so it has no formats to show */
+  if (ok && trace_formats && !hit)
+    {
+      GString *trace = g_string_new (NULL);
+      guint    n     = rock_graph_trace_formats (rg, trace);
+
+      g_print ("%s%u format conversions in %s\n", trace->str, n, job->name);
+      g_string_free (trace, TRUE);
+    }
+  g_mutex_unlock (&stats.mutex);
+
+  if (report)
+    g_string_free (report, TRUE);
+  g_clear_error (&error);
+  g_free (output);
+}
+
+/* Runs one share of jobs, in order, on this threadꞌs graph. */
+static void
+render_share (gpointer data,
+              gpointer user_data)
+{
+  GPtrArray *share = data;
+  RockGraph *rg    = thread_graph (&worker_graph, band_height >= 0);
+  guint      i;
+
+  for (i = 0; i < share->len; i++)
+    render_one (rg, g_ptr_array_index (share, i));
+
+  g_ptr_array_unref (share);
+}
+
+/* Pushes the jobs to the pool. Plain jobs go one by one, the variants of
+ * one entry are cut in at most n_threads contiguous shares.
+ */
+static void
+push_jobs (GThreadPool *pool,
+           GList       *jobs)
+{
+  GList *iter = jobs;
+
+  while (iter)
+    {
+      RockJob *job = iter->data;
+      GList   *end = iter->next;
+      guint    n_family = 1, per_share, i;
+
+      if (job->family)
+        while (end && !g_strcmp0 (((RockJob *) end->data)->family, job->family))
+          {
+            n_family++;
+            end = end->next;
+          }
+
+      per_share = (n_family + n_threads - 1) / n_threads;
+
+      while (iter != end)
+        {
+          GPtrArray *share = g_ptr_array_new ();
+
+          for (i = 0; i < per_share && iter != end; i++, iter = iter->next)
+            g_ptr_array_add (share, iter->data);
+
+          g_thread_pool_push (pool, share, NULL);
+        }
+    }
+}
+
+/* Renders the job at quality on a fresh graph, to path, and returns the time taken or -1 */
+static gint64
+time_quality (const RockJob *job,
+              const gchar   *quality,
+              const gchar   *path,
+              GError       **error)
+{
+  RockJob   *copy = rock_job_with_property (job, "quality", quality, path);
+  RockGraph *rg   = rock_graph_new (FALSE);
+  gint64     start;
+  gint64     elapsed;
+
+  start   = g_get_monotonic_time ();
+  elapsed = rock_graph_apply (rg, copy, error) &&
+            rock_graph_render (rg, copy, NULL, NULL, error) ? g_get_monotonic_time () - start : -1;
+
+  rock_graph_free (rg);
+  rock_job_free (copy);
+
+  return elapsed;
+}
+
+/* Speed and error of the cheaper qualities against final, one job at a time
+ * so the timings do not compete for cores.
+ */
+static gint
+run_quality_report (GList *jobs)
+{
+  static const gchar *qualities[] = { "final", "normal", "draft" };
+  GError  *error = NULL;
+  gchar   *dir;
+  gdouble  sum_speedup[3] = { 0, }, sum_ssim[3] = { 0, }, worst[3] = { 0, };
+  guint    n = 0, q;
+  GList   *iter;
+
+  dir = g_dir_make_tmp ("rock-text-quality-XXXXXX", &error);
+  if (!dir)
+    {
+      g_printerr ("%s\n", error->message);
+      g_clear_error (&error);
+      return EXIT_FAILURE;
+    }
+
+  g_print ("%-24s %-7s %9s %8s %8s %9s %7s\n",
+           "entry", "quality", "ms", "speedup", "max", "mean", "ssim");
+
+  for (iter = jobs; iter; iter = iter->next)
+    {
+      RockJob *job = iter->data;
+      gchar   *paths[3];
+      gint64   times[3];
+      gboolean ok = TRUE;
+
+      for (q = 0; q < 3; q++)
+        {
+          gchar *name = g_strdup_printf ("%u-%s.png", n, qualities[q]);
+          paths[q] = g_build_filename (dir, name, NULL);
+          g_free (name);
+        }
+
+      /* The first render also fills the text mask cache, keep it out of the timings */
+      ok = time_quality (job, "final", paths[0], &error) >= 0;
+      for (q = 0; q < 3 && ok; q++)
+        ok = (times[q] = time_quality (job, qualities[q], paths[q], &error)) >= 0;
+
+      for (q = 0; q < 3 && ok; q++)
+        {
+          RockCompareResult result = { 0, };
+          gdouble           speedup = times[q] ? (gdouble) times[0] / times[q] : 1.0;
+
+          if (q > 0 && !rock_compare_files (paths[q], paths[0], &result, &error))
+            {
+              ok = FALSE;
+              break;
+            }
+          if (q == 0)
+            result.ssim = 1.0;
+
+          g_print ("%-24s %-7s %9.1f %7.2fx %8.4f %9.5f %7.4f\n",
+                   job->name, qualities[q], times[q] / 1000.0, speedup,
+                   result.max_diff, result.mean_diff, result.ssim);
+
+          sum_speedup[q] += speedup;
+          sum_ssim[q]    += result.ssim;
+          worst[q]        = MAX (worst[q], result.max_diff);
+        }
+
+      if (!ok)
+        {
+          g_printerr ("%s: %s\n", job->name, error ? error->message : "failed");
+          g_clear_error (&error);
+        }
+      else
+        {
+          n++;
+        }
+
+      for (q = 0; q < 3; q++)
+        {
+          g_remove (paths[q]);
+          g_free (paths[q]);
+        }
+    }
+
+  for (q = 1; q < 3 && n; q++)
+    g_print ("%s over %u entries: %.2fx faster than final, mean ssim %.4f, worst channel error %.4f\n",
+             qualities[q], n, sum_speedup[q] / n, sum_ssim[q] / n, worst[q]);
+
+  g_rmdir (dir);
+  g_free (dir);
+
+  return n == g_list_length (jobs) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* The cost of loading rock text before the first card, run after gegl_init */
+static gint
+run_startup_benchmark (gint64 init_us)
+{
+  RockGraph *rg;
+  GError    *error = NULL;
+  GList     *jobs;
+  gchar     *output;
+  gchar     *data;
+  gint64     start, build_us, render_us;
+  gboolean   ok;
+
+  output = g_build_filename (g_get_tmp_dir (), "rock-text-startup.png", NULL);
+  data   = g_strdup_printf ("[startup]\ntext=Rock\nfont-size=48\noutput=%s\n", output);
+  jobs   = rock_job_load_data (data, strlen (data), &error);
+  g_free (data);
+
+  start    = g_get_monotonic_time ();
+  rg       = rock_graph_new (FALSE);
+  build_us = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  ok = jobs &&
+       rock_graph_apply (rg, jobs->data, &error) &&
+       rock_graph_render (rg, jobs->data, NULL, NULL, &error);
+  render_us = g_get_monotonic_time () - start;
+
+  if (ok)
+    g_print ("gegl_init %.1f ms, graph %.1f ms, first render %.1f ms, total %.1f ms\n"
+             "helper ops:%s%s%s%s%s%s%s\n",
+             init_us / 1000.0, build_us / 1000.0, render_us / 1000.0,
+             (init_us + build_us + render_us) / 1000.0,
+             gegl_has_operation ("lb:rock-colorize") ? " colorize" : "",
+             gegl_has_operation ("lb:rock-finish")   ? " finish"   : "",
+             gegl_has_operation ("lb:rock-bevel")    ? " bevel"    : "",
+             gegl_has_operation ("lb:rock-outline")  ? " outline"  : "",
+             gegl_has_operation ("lb:rock-upsample") ? " upsample" : "",
+             gegl_has_operation ("lb:rock-median")   ? " median"   : "",
+             gegl_has_operation ("lb:rock-spread")   ? " spread"   : "");
+  else
+    g_printerr ("startup benchmark: %s\n", error ? error->message : "no job");
+
+  g_remove (output);
+  g_clear_error (&error);
+  rock_graph_free (rg);
+  g_list_free_full (jobs, (GDestroyNotify) rock_job_free);
+  g_free (output);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Best of three renders of layer through a fresh median node, the result is kept in *result */
+static gint64
+time_median (GeglBuffer  *layer,
+             const gchar *operation,
+             gint         radius,
+             GeglBuffer **result)
+{
+  gint64 best = G_MAXINT64;
+  gint   i;
+
+  for (i = 0; i < 3; i++)
+    {
+      GeglNode     *graph  = gegl_node_new ();
+      GeglNode     *source, *median;
+      GeglRectangle bbox;
+      gint64        start;
+
+      source = gegl_node_new_child (graph,
+                                    "operation", "gegl:buffer-source",
+                                    "buffer", layer,
+                                    NULL);
+      median = gegl_node_new_child (graph,
+                                    "operation", operation,
+                                    "radius", radius,
+                                    "alpha-percentile", 50.0,
+                                    NULL);
+      if (!strcmp (operation, "gegl:median-blur"))
+        gegl_node_set (median, "abyss-policy", 0, NULL);
+      gegl_node_link (source, median);
+
+      start = g_get_monotonic_time ();
+      bbox  = gegl_node_get_bounding_box (median);
+      g_clear_object (result);
+      *result = gegl_node_blit_buffer (median, NULL, &bbox, 0, GEGL_ABYSS_NONE);
+      best = MIN (best, g_get_monotonic_time () - start);
+
+      g_object_unref (graph);
+    }
+
+  return best;
+}
+
+/* Largest difference of alpha, and of color where either is not transparent */
+static void
+median_difference (GeglBuffer *a,
+                   GeglBuffer *b,
+                   gfloat     *alpha_diff,
+                   gfloat     *color_diff)
+{
+  const Babl   *format = babl_format ("R'G'B'A float");
+  GeglRectangle rect   = *gegl_buffer_get_extent (a);
+  gfloat       *pa, *pb;
+  gint          i, c, n;
+
+  gegl_rectangle_intersect (&rect, &rect, gegl_buffer_get_extent (b));
+  n  = rect.width * rect.height;
+  pa = g_new (gfloat, (gsize) n * 4);
+  pb = g_new (gfloat, (gsize) n * 4);
+  gegl_buffer_get (a, &rect, 1.0, format, pa, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  gegl_buffer_get (b, &rect, 1.0, format, pb, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  *alpha_diff = *color_diff = 0.0f;
+  for (i = 0; i < n; i++)
+    {
+      *alpha_diff = MAX (*alpha_diff, fabsf (pa[i * 4 + 3] - pb[i * 4 + 3]));
+      if (pa[i * 4 + 3] > 0.0f && pb[i * 4 + 3] > 0.0f)
+        for (c = 0; c < 3; c++)
+          *color_diff = MAX (*color_diff, fabsf (pa[i * 4 + c] - pb[i * 4 + c]));
+    }
+
+  g_free (pa);
+  g_free (pb);
+}
+
+static gint
+run_median_benchmark (void)
+{
+  GeglNode     *graph, *text;
+  GeglBuffer   *layer;
+  GeglRectangle bbox;
+  gint          radius;
+
+  if (!gegl_has_operation ("lb:rock-median"))
+    {
+      g_printerr ("lb:rock-median is not installed in the GEGL plug-ins folder\n");
+      return EXIT_FAILURE;
+    }
+
+  /* A layer like the ones rock text gets, rendered once so only the medians are timed */
+  graph = gegl_node_new ();
+  text  = gegl_node_new_child (graph,
+                               "operation", "gegl:text",
+                               "string", "Rock Text",
+                               "size", 400.0,
+                               NULL);
+  bbox  = gegl_node_get_bounding_box (text);
+  layer = gegl_node_blit_buffer (text, NULL, &bbox, 0, GEGL_ABYSS_NONE);
+  g_object_unref (graph);
+
+  g_print ("%dx%d text layer\n"
+           "radius  median-blur ms  rock-median ms  speedup  max alpha diff  max color diff\n",
+           bbox.width, bbox.height);
+
+  for (radius = 1; radius <= 10; radius++)
+    {
+      GeglBuffer *reference = NULL, *fast = NULL;
+      gint64      reference_us, fast_us;
+      gfloat      alpha_diff, color_diff;
+
+      reference_us = time_median (layer, "gegl:median-blur", radius, &reference);
+      fast_us      = time_median (layer, "lb:rock-median",   radius, &fast);
+      median_difference (reference, fast, &alpha_diff, &color_diff);
+
+      g_print ("%6d  %14.1f  %14.1f  %6.2fx  %14.4f  %14.4f\n", radius,
+               reference_us / 1000.0, fast_us / 1000.0,
+               fast_us ? (gdouble) reference_us / fast_us : 0.0,
+               alpha_diff, color_diff);
+
+      g_object_unref (reference);
+      g_object_unref (fast);
+    }
+
+  g_object_unref (layer);
+  return EXIT_SUCCESS;
+}
+
+/* Mean difference of any premultiplied channel that --finish-check allows */
+#define FINISH_CHECK_LIMIT (2.0 / 255.0)
+
+static gint64
+time_finish (GeglBuffer  *layer,
+             gboolean     fused,
+             GeglBuffer **result)
+{
+  gint64 best = G_MAXINT64;
+  gint   i;
+
+  for (i = 0; i < 3; i++)
+    {
+      GeglNode     *graph = gegl_node_new ();
+      GeglNode     *source, *grain, *finish, *last;
+      GeglRectangle bbox;
+      gint64        start;
+
+      source = gegl_node_new_child (graph,
+                                    "operation", "gegl:buffer-source",
+                                    "buffer", layer,
+                                    NULL);
+      grain  = gegl_node_new_child (graph,
+                                    "operation", "gegl:noise-hsv",
+                                    "seed", 1,
+                                    NULL);
+      /* The settings rock text gives its edgesmooth node */
+      finish = gegl_node_new_child (graph,
+                                    "operation", "lb:rock-finish",
+                                    "edgesmooth", fused,
+                                    "alpha-percentile2", 67.0,
+                                    "gaus", 0.75,
+                                    "value", 2.2,
+                                    NULL);
+      gegl_node_link_many (source, grain, NULL);
+      gegl_node_link_many (source, finish, NULL);
+      gegl_node_connect (finish, "aux", grain, "output");
+      last = finish;
+
+      if (!fused)
+        {
+          last = gegl_node_new_child (graph,
+                                      "operation", "lb:edgesmooth",
+                                      "alpha-percentile2", 67.0,
+                                      "gaus", 0.75,
+                                      "value", 2.2,
+                                      "abyss-policy", 0,
+                                      NULL);
+          gegl_node_link (finish, last);
+        }
+
+      start = g_get_monotonic_time ();
+      bbox  = gegl_node_get_bounding_box (last);
+      g_clear_object (result);
+      *result = gegl_node_blit_buffer (last, NULL, &bbox, 0, GEGL_ABYSS_NONE);
+      best = MIN (best, g_get_monotonic_time () - start);
+
+      g_object_unref (graph);
+    }
+
+  return best;
+}
+
+/* lb:edgesmooth on its own, with its default settings, on a text layer.
+ * Written to edgesmooth.png and compared with the reference of that name.
+ */
+static gboolean
+check_edgesmooth_reference (void)
+{
+  const gchar *output = "edgesmooth.png";
+  GeglNode    *graph, *text, *smooth, *save;
+  GError      *error  = NULL;
+  gboolean     ok;
+
+  graph  = gegl_node_new ();
+  text   = gegl_node_new_child (graph,
+                                "operation", "gegl:text",
+                                "string", "Edge",
+                                "size", 96.0,
+                                NULL);
+  smooth = gegl_node_new_child (graph,
+                                "operation", "lb:edgesmooth",
+                                NULL);
+  save   = gegl_node_new_child (graph,
+                                "operation", "gegl:save",
+                                "path", output,
+                                NULL);
+  gegl_node_link_many (text, smooth, save, NULL);
+
+  g_remove (output);
+  gegl_node_process (save);
+  g_object_unref (graph);
+
+  ok = compare_reference (output, &error);
+  if (!ok)
+    {
+      g_printerr ("%s: %s\n", output, error->message);
+      g_clear_error (&error);
+    }
+  else
+    {
+      g_print ("lb:edgesmooth matches its reference\n");
+    }
+
+  return ok;
+}
+
+static gint
+run_finish_check (void)
+{
+  const Babl   *format = babl_format ("R'aG'aB'aA float");
+  GeglNode     *graph, *text;
+  GeglBuffer   *layer, *fused = NULL, *separate = NULL;
+  GeglRectangle bbox;
+  gint64        fused_us, separate_us;
+  gfloat       *pa, *pb;
+  gdouble       max_diff = 0.0, sum = 0.0, mean;
+  gint          i, n;
+
+  if (!gegl_has_operation ("lb:rock-finish") || !gegl_has_operation ("lb:edgesmooth"))
+    {
+      g_printerr ("lb:rock-finish and lb:edgesmooth must be installed in the GEGL plug-ins folder\n");
+      return EXIT_FAILURE;
+    }
+
+  graph = gegl_node_new ();
+  text  = gegl_node_new_child (graph,
+                               "operation", "gegl:text",
+                               "string", "Rock Text",
+                               "size", 200.0,
+                               NULL);
+  bbox  = gegl_node_get_bounding_box (text);
+  layer = gegl_node_blit_buffer (text, NULL, &bbox, 0, GEGL_ABYSS_NONE);
+  g_object_unref (graph);
+
+  fused_us    = time_finish (layer, TRUE,  &fused);
+  separate_us = time_finish (layer, FALSE, &separate);
+
+  /* Both grow the text by the reach of the edge smoothing */
+  bbox = *gegl_buffer_get_extent (separate);
+  gegl_rectangle_bounding_box (&bbox, &bbox, gegl_buffer_get_extent (fused));
+  n  = bbox.width * bbox.height;
+  pa = g_new (gfloat, (gsize) n * 4);
+  pb = g_new (gfloat, (gsize) n * 4);
+  gegl_buffer_get (fused,    &bbox, 1.0, format, pa, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  gegl_buffer_get (separate, &bbox, 1.0, format, pb, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  for (i = 0; i < n * 4; i++)
+    {
+      gdouble diff = fabs (pa[i] - pb[i]);
+
+      max_diff = MAX (max_diff, diff);
+      sum     += diff;
+    }
+  mean = n ? sum / (n * 4.0) : 0.0;
+
+  g_print ("%dx%d text layer\n"
+           "fused %.1f ms, rock-finish and edgesmooth %.1f ms, %.2fx\n"
+           "max difference %.4f, mean difference %.5f\n",
+           bbox.width, bbox.height, fused_us / 1000.0, separate_us / 1000.0,
+           fused_us ? (gdouble) separate_us / fused_us : 0.0, max_diff, mean);
+
+  g_free (pa);
+  g_free (pb);
+  g_object_unref (fused);
+  g_object_unref (separate);
+  g_object_unref (layer);
+
+  if (mean > FINISH_CHECK_LIMIT)
+    {
+      g_printerr ("the fused edge smoothing is further off than %.5f\n", FINISH_CHECK_LIMIT);
+      return EXIT_FAILURE;
+    }
+
+  if (reference_dir && !check_edgesmooth_reference ())
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
+
+/* Saves a text layer to before and the same layer with a small mark inside
+ * it to after, and returns the rectangle of the mark
+ */
+static GeglRectangle
+write_dirty_layers (const gchar *before,
+                    const gchar *after)
+{
+  GeglNode     *graph, *text, *mark, *move, *over, *save;
+  GeglRectangle bbox, changed;
+
+  graph = gegl_node_new ();
+  text  = gegl_node_new_child (graph,
+                               "operation", "gegl:text",
+                               "string", "Rock Text",
+                               "size", 120.0,
+                               NULL);
+  bbox  = gegl_node_get_bounding_box (text);
+  mark  = gegl_node_new_child (graph,
+                               "operation", "gegl:text",
+                               "string", "o",
+                               "size", 24.0,
+                               NULL);
+  move  = gegl_node_new_child (graph,
+                               "operation", "gegl:translate",
+                               "x", (gdouble) (bbox.x + bbox.width / 3),
+                               "y", (gdouble) (bbox.y + bbox.height / 3),
+                               NULL);
+  over  = gegl_node_new_child (graph,
+                               "operation", "gegl:over",
+                               NULL);
+  save  = gegl_node_new_child (graph,
+                               "operation", "gegl:save",
+                               "path", before,
+                               NULL);
+
+  gegl_node_link (text, save);
+  gegl_node_process (save);
+
+  gegl_node_link (mark, move);
+  gegl_node_link_many (text, over, save, NULL);
+  gegl_node_connect (over, "aux", move, "output");
+  gegl_node_set (save, "path", after, NULL);
+  gegl_node_process (save);
+
+  changed = gegl_node_get_bounding_box (move);
+  g_object_unref (graph);
+
+  return changed;
+}
+
+static gint
+run_dirty_check (void)
+{
+  RockCompareResult result = { 0, };
+  RockGraph        *rg, *full_rg;
+  GeglRectangle     changed, rendered = { 0, };
+  GError           *error = NULL;
+  GList            *jobs;
+  gchar            *dir, *before, *after, *updated, *full, *data;
+  gboolean          ok;
+
+  dir = g_dir_make_tmp ("rock-text-dirty-XXXXXX", &error);
+  if (!dir)
+    {
+      g_printerr ("%s\n", error->message);
+      g_clear_error (&error);
+      return EXIT_FAILURE;
+    }
+
+  before  = g_build_filename (dir, "before.png", NULL);
+  after   = g_build_filename (dir, "after.png", NULL);
+  updated = g_build_filename (dir, "updated.png", NULL);
+  full    = g_build_filename (dir, "full.png", NULL);
+  changed = write_dirty_layers (before, after);
+
+  /* The first entry renders the old layer to updated, the second one both
+   * updates that and renders the new layer in full
+   */
+  data = g_strdup_printf ("[before]\ninput=%s\nbounded-reach=true\nseed=3\nseed2=5\noutput=%s\n"
+                          "[after]\ninput=%s\nbounded-reach=true\nseed=3\nseed2=5\noutput=%s\n",
+                          before, updated, after, full);
+  jobs = rock_job_load_data (data, strlen (data), &error);
+  g_free (data);
+
+  rg      = rock_graph_new (FALSE);
+  full_rg = rock_graph_new (FALSE);
+  ok = jobs && jobs->next &&
+       rock_graph_apply (rg, jobs->data, &error) &&
+       rock_graph_render (rg, jobs->data, NULL, NULL, &error) &&
+       rock_graph_apply (rg, jobs->next->data, &error) &&
+       rock_graph_render_dirty (rg, jobs->next->data, &changed, updated, &rendered, &error) &&
+       rock_graph_apply (full_rg, jobs->next->data, &error) &&
+       rock_graph_render (full_rg, jobs->next->data, NULL, NULL, &error) &&
+       rock_compare_files (updated, full, &result, &error);
+
+  if (ok)
+    g_print ("changed %dx%d at %d,%d, updated %dx%d, max difference to a full render %.6f\n",
+             changed.width, changed.height, changed.x, changed.y,
+             rendered.width, rendered.height, result.max_diff);
+  else
+    g_printerr ("%s\n", error ? error->message : "the check could not run");
+
+  if (ok && result.max_diff != 0.0)
+    {
+      g_printerr ("the updated render differs from the full render\n");
+      ok = FALSE;
+    }
+
+  g_clear_error (&error);
+  rock_graph_free (rg);
+  rock_graph_free (full_rg);
+  g_list_free_full (jobs, (GDestroyNotify) rock_job_free);
+  g_remove (before);
+  g_remove (after);
+  g_remove (updated);
+  g_remove (full);
+  g_rmdir (dir);
+  g_free (before);
+  g_free (after);
+  g_free (updated);
+  g_free (full);
+  g_free (dir);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GThreadPool    *pool;
+  GError         *error = NULL;
+  GList          *jobs;
+  GList          *iter;
+  gint64          start, wall;
+  gint            status;
+
+  context = g_option_context_new ("MANIFEST - render rock text title cards");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gegl_get_option_group ());
+
+  if (!g_option_context_parse (context, &argc, &argv, &error) ||
+      argc != (startup_benchmark || median_benchmark || finish_check || dirty_check ? 1 : 2))
+    {
+      g_printerr ("%s\n", error ? error->message : "exactly one manifest is needed");
+      g_printerr ("%s", g_option_context_get_help (context, TRUE, NULL));
+      return EXIT_FAILURE;
+    }
+
+  if (shard_arg &&
+      (sscanf (shard_arg, "%d/%d", &shard, &n_shards) != 2 ||
+       n_shards < 1 || shard < 0 || shard >= n_shards))
+    {
+      g_printerr ("--shard expects I/N with 0 <= I < N\n");
+      return EXIT_FAILURE;
+    }
+
+  if (rect_arg &&
+      (sscanf (rect_arg, "%d,%d,%d,%d",
+               &rect.x, &rect.y, &rect.width, &rect.height) != 4 ||
+       rect.width <= 0 || rect.height <= 0))
+    {
+      g_printerr ("--rect expects X,Y,W,H\n");
+      return EXIT_FAILURE;
+    }
+
+  if (shard_arg && rect_arg)
+    {
+      g_printerr ("--shard and --rect both pick the region to render, use one of them\n");
+      return EXIT_FAILURE;
+    }
+
+  if (dirty_arg &&
+      (sscanf (dirty_arg, "%d,%d,%d,%d",
+               &dirty.x, &dirty.y, &dirty.width, &dirty.height) != 4 ||
+       dirty.width <= 0 || dirty.height <= 0))
+    {
+      g_printerr ("--dirty expects X,Y,W,H\n");
+      return EXIT_FAILURE;
+    }
+
+  if (dirty_arg && (shard_arg || rect_arg || band_height >= 0 || cache_dir))
+    {
+      g_printerr ("--dirty updates whole outputs, it does not go with --shard, --rect, --band-height or --cache-dir\n");
+      return EXIT_FAILURE;
+    }
+
+  if (memory_budget > 0 && (band_height >= 0 || dirty_arg || cache_dir))
+    {
+      g_printerr ("--memory-budget picks how to render, it does not go with --band-height, --dirty or --cache-dir\n");
+      return EXIT_FAILURE;
+    }
+
+  start = g_get_monotonic_time ();
+  gegl_init (&argc, &argv);
+  wall = g_get_monotonic_time () - start;
+
+  if (!gegl_has_operation ("lb:rock-text"))
+    {
+      g_printerr ("lb:rock-text is not installed in the GEGL plug-ins folder\n");
+      gegl_exit ();
+      return EXIT_FAILURE;
+    }
+
+  if (median_benchmark)
+    {
+      status = run_median_benchmark ();
+      g_option_context_free (context);
+      gegl_exit ();
+      return status;
+    }
+
+  if (dirty_check)
+    {
+      status = run_dirty_check ();
+      g_option_context_free (context);
+      gegl_exit ();
+      return status;
+    }
+
+  if (finish_check)
+    {
+      status = run_finish_check ();
+      g_option_context_free (context);
+      gegl_exit ();
+      return status;
+    }
+
+  if (startup_benchmark)
+    {
+      status = run_startup_benchmark (wall);
+      g_option_context_free (context);
+      gegl_exit ();
+      return status;
+    }
+
+  jobs = rock_job_load_manifest (argv[1], &error);
+  if (!jobs)
+    {
+      g_printerr ("%s: %s\n", argv[1], error ? error->message : "no entries");
+      g_clear_error (&error);
+      gegl_exit ();
+      return EXIT_FAILURE;
+    }
+
+  if (quality_report)
+    {
+      status = run_quality_report (jobs);
+      g_list_free_full (jobs, (GDestroyNotify) rock_job_free);
+      g_option_context_free (context);
+      gegl_exit ();
+      return status;
+    }
+
+  if (n_threads <= 0)
+    n_threads = (gint) g_get_num_processors ();
+
+  /* A reference run has to render every entry, a cached image proves nothing */
+  if (cache_dir && reference_dir)
+    g_printerr ("--reference renders every entry, --cache-dir is not used\n");
+
+  /* Band rendering never holds the whole result, which is what the cache stores */
+  if (cache_dir && band_height < 0 && !reference_dir)
+    {
+      cache = rock_cache_new (cache_dir, (guint64) MAX (cache_size, 1) << 20, &error);
+      if (!cache)
+        {
+          g_printerr ("%s\n", error->message);
+          g_clear_error (&error);
+          g_list_free_full (jobs, (GDestroyNotify) rock_job_free);
+          gegl_exit ();
+          return EXIT_FAILURE;
+        }
+    }
+
+  /* Animations write their frames from a pool of their own */
+  for (iter = jobs; iter; iter = iter->next)
+    if (((RockJob *) iter->data)->animated)
+      {
+        frame_writer = rock_frame_writer_new (MAX (n_threads / 2, 1), 2 * n_threads);
+        break;
+      }
+
+  /* Tiles past the budget of every worker go to swap instead of piling up */
+  if (memory_budget > 0)
+    g_object_set (gegl_config (),
+                  "tile-cache-size", ((guint64) memory_budget * n_threads) << 20,
+                  NULL);
+
+  g_mutex_init (&stats.mutex);
+  all_graphs = g_ptr_array_new_with_free_func ((GDestroyNotify) rock_graph_free);
+  pool = g_thread_pool_new (render_share, NULL, n_threads, TRUE, NULL);
+
+  gegl_reset_stats ();
+  start = g_get_monotonic_time ();
+  push_jobs (pool, jobs);
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+  stats.failed += rock_frame_writer_free (frame_writer);
+  wall = g_get_monotonic_time () - start;
+
+  g_print ("%u rendered, %u failed, %u from cache, %.1f s wall, %.1f ms mean per item, %.2f items/s\n",
+           stats.done - stats.failed, stats.failed, stats.cache_hits,
+           wall / 1000000.0,
+           stats.done ? stats.busy_us / 1000.0 / stats.done : 0.0,
+           wall ? stats.done * 1000000.0 / wall : 0.0);
+  if (stats.frames)
+    g_print ("%u frames: %u full, %u from shape, %u relit, %u recolored, %u unchanged\n",
+             stats.frames,
+             stats.stages[ROCK_STAGE_TEXT], stats.stages[ROCK_STAGE_SHAPE],
+             stats.stages[ROCK_STAGE_LIGHT], stats.stages[ROCK_STAGE_FINISH],
+             stats.stages[ROCK_STAGE_NONE]);
+  if (stats.strategies[ROCK_MEMORY_FULL] + stats.strategies[ROCK_MEMORY_RECOMPUTE] +
+      stats.strategies[ROCK_MEMORY_BANDS])
+    {
+      guint64 peak = 0;
+
+      g_object_get (gegl_stats (), "tile-cache-total-max", &peak, NULL);
+      g_print ("memory budgets: %u full, %u recompute, %u bands, %u over budget, tile cache peak %.1f MiB\n",
+               stats.strategies[ROCK_MEMORY_FULL], stats.strategies[ROCK_MEMORY_RECOMPUTE],
+               stats.strategies[ROCK_MEMORY_BANDS], stats.over_budget, peak / 1048576.0);
+    }
+
+  g_ptr_array_free (all_graphs, TRUE);
+  rock_cache_free (cache);
+  g_list_free_full (jobs, (GDestroyNotify) rock_job_free);
+  g_option_context_free (context);
+  g_mutex_clear (&stats.mutex);
+  gegl_exit ();
+
+  return stats.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
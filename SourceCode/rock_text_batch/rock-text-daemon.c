@@ -0,0 +1,496 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+A long running lb:rock-text renderer on a Unix domain socket, so small titles do not pay for starting
+GEGL, scanning the plug-ins and building the graph every time.
+
+rock-text-daemon --threads 4 --socket $XDG_RUNTIME_DIR/rock-text.sock
+
+It builds one graph per thread up front and lends them out to requests. A connection can send any number
+of requests, each one a command line followed by more lines:
+
+render
+text=Hello
+font-size=96
+output=/dev/shm/hello.png
+seed=12
+(empty line)
+
+The lines after render are the body of one manifest entry (see rock-job.h), seeds= included. The answer
+is one line per image, "ok MS PATH" or "error MESSAGE", and an empty line. With output=- the PNG is sent
+back on the socket: "ok MS N" followed by N bytes of PNG data, then the empty line. An output under
+/dev/shm keeps the image in shared memory.
+
+stats
+
+answers with one line, queue depth, busy graphs, done and failed counts, latency percentiles over the
+last 1024 images and the throughput since start, then an empty line.
+
+Requests are trusted: the input=, src= and output= paths they name are read and written with the
+privileges of the daemon. The socket is only accessible to the user running it, keep it in a folder
+only that user can reach, like the default $XDG_RUNTIME_DIR. A path that is not a socket, or a socket
+another daemon still answers on, is never removed; the daemon refuses to start instead.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include "rock-job.h"
+#include "rock-cache.h"
+
+#define LATENCY_WINDOW 1024
+
+static gchar   *socket_path = NULL;
+static gint     n_threads   = 0;
+static gint     max_clients = 64;
+static gchar   *cache_dir   = NULL;
+static gint     cache_size  = 2048;
+
+static GOptionEntry entries[] =
+{
+  { "socket", 's', 0, G_OPTION_ARG_FILENAME, &socket_path,
+    "Socket to listen on (default: rock-text.sock in the user runtime folder)", "PATH" },
+  { "threads", 't', 0, G_OPTION_ARG_INT, &n_threads,
+    "Number of graphs rendering at the same time (default: number of processors)", "N" },
+  { "clients", 0, 0, G_OPTION_ARG_INT, &max_clients,
+    "Number of connections served at the same time (default: 64)", "N" },
+  { "cache-dir", 'c', 0, G_OPTION_ARG_FILENAME, &cache_dir,
+    "Reuse and keep finished renders in this folder", "DIR" },
+  { "cache-size", 0, 0, G_OPTION_ARG_INT, &cache_size,
+    "Size limit of the render cache in MiB (default: 2048)", "MB" },
+  { NULL }
+};
+
+typedef struct
+{
+  GMutex  mutex;
+  gint    queued;
+  gint    busy;
+  guint64 done;
+  guint64 failed;
+  gdouble latency_ms[LATENCY_WINDOW];
+  guint64 n_latency;
+  gint64  started;
+} DaemonStats;
+
+static DaemonStats  stats;
+static GAsyncQueue *idle_graphs;
+static RockCache   *cache;
+
+static gboolean
+send_string (GOutputStream *out,
+             GString       *string)
+{
+  return g_output_stream_write_all (out, string->str, string->len,
+                                    NULL, NULL, NULL);
+}
+
+/* Renders one image on a borrowed graph, the latency includes the wait */
+static gboolean
+render_job (RockJob      *job,
+            const gchar  *output,
+            gdouble      *ms,
+            GError      **error)
+{
+  RockGraph *rg;
+  gint64     start = g_get_monotonic_time ();
+  gboolean   hit;
+  gboolean   ok;
+
+  g_mutex_lock (&stats.mutex);
+  stats.queued++;
+  g_mutex_unlock (&stats.mutex);
+
+  rg = g_async_queue_pop (idle_graphs);
+
+  g_mutex_lock (&stats.mutex);
+  stats.queued--;
+  stats.busy++;
+  g_mutex_unlock (&stats.mutex);
+
+  /* A cached result is saved without applying the job at all */
+  hit = FALSE;
+  ok  = !cache || rock_cache_save_hit (cache, rg, job, NULL, output, &hit, error);
+  if (ok && !hit)
+    ok = rock_graph_apply (rg, job, error) &&
+         (cache ? rock_cache_render (cache, rg, job, NULL, output, error) :
+                  rock_graph_render (rg, job, NULL, output, error));
+
+  g_async_queue_push (idle_graphs, rg);
+  *ms = (g_get_monotonic_time () - start) / 1000.0;
+
+  g_mutex_lock (&stats.mutex);
+  stats.busy--;
+  stats.done++;
+  if (!ok)
+    stats.failed++;
+  stats.latency_ms[stats.n_latency++ % LATENCY_WINDOW] = *ms;
+  g_mutex_unlock (&stats.mutex);
+
+  return ok;
+}
+
+static void
+handle_render (GOutputStream *out,
+               GString       *body)
+{
+  GString *reply = g_string_new (NULL);
+  GError  *error = NULL;
+  GList   *jobs  = rock_job_load_data (body->str, body->len, &error);
+  GList   *iter;
+
+  if (!jobs)
+    g_string_append_printf (reply, "error %s\n",
+                            error ? error->message : "empty request");
+  g_clear_error (&error);
+
+  for (iter = jobs; iter; iter = iter->next)
+    {
+      RockJob  *job       = iter->data;
+      gboolean  send_back = !strcmp (job->output, "-");
+      gchar    *tmp       = NULL;
+      gchar    *contents  = NULL;
+      gsize     length    = 0;
+      gdouble   ms        = 0.0;
+      gboolean  ok        = TRUE;
+
+      if (send_back && jobs->next)
+        {
+          g_string_append (reply, "error output=- only works for a single image\n");
+          continue;
+        }
+
+      if (send_back)
+        {
+          gint fd = g_file_open_tmp ("rock-text-XXXXXX.png", &tmp, &error);
+
+          ok = fd >= 0;
+          if (ok)
+            close (fd);
+        }
+
+      if (ok)
+        ok = render_job (job, send_back ? tmp : NULL, &ms, &error);
+
+      if (ok && send_back)
+        ok = g_file_get_contents (tmp, &contents, &length, &error);
+
+      if (!ok)
+        {
+          g_string_append_printf (reply, "error %s\n", error->message);
+        }
+      else if (send_back)
+        {
+          g_string_append_printf (reply, "ok %.1f %" G_GSIZE_FORMAT "\n", ms, length);
+          g_string_append_len (reply, contents, length);
+        }
+      else
+        {
+          g_string_append_printf (reply, "ok %.1f %s\n", ms, job->output);
+        }
+
+      if (tmp)
+        g_unlink (tmp);
+      g_free (tmp);
+      g_free (contents);
+      g_clear_error (&error);
+    }
+
+  g_string_append_c (reply, '\n');
+  send_string (out, reply);
+
+  g_string_free (reply, TRUE);
+  g_list_free_full (jobs, (GDestroyNotify) rock_job_free);
+}
+
+static gint
+cmp_double (gconstpointer a,
+            gconstpointer b)
+{
+  gdouble da = *(const gdouble *) a;
+  gdouble db = *(const gdouble *) b;
+
+  return (da > db) - (da < db);
+}
+
+static void
+handle_stats (GOutputStream *out)
+{
+  GString *reply = g_string_new (NULL);
+  gdouble  window[LATENCY_WINDOW];
+  gdouble  p50 = 0.0, p90 = 0.0, p99 = 0.0;
+  gdouble  uptime;
+  guint64  rendered;
+  guint    n;
+
+  g_mutex_lock (&stats.mutex);
+  n = MIN (stats.n_latency, LATENCY_WINDOW);
+  memcpy (window, stats.latency_ms, n * sizeof (gdouble));
+  uptime   = (g_get_monotonic_time () - stats.started) / 1000000.0;
+  rendered = stats.done - stats.failed;
+  g_string_append_printf (reply, "queue=%d busy=%d done=%" G_GUINT64_FORMAT
+                          " failed=%" G_GUINT64_FORMAT,
+                          stats.queued, stats.busy, stats.done, stats.failed);
+  g_mutex_unlock (&stats.mutex);
+
+  if (n)
+    {
+      qsort (window, n, sizeof (gdouble), cmp_double);
+      p50 = window[(n - 1) * 50 / 100];
+      p90 = window[(n - 1) * 90 / 100];
+      p99 = window[(n - 1) * 99 / 100];
+    }
+
+  g_string_append_printf (reply, " p50=%.1fms p90=%.1fms p99=%.1fms throughput=%.2f/s\n\n",
+                          p50, p90, p99,
+                          uptime > 0.0 ? rendered / uptime : 0.0);
+  send_string (out, reply);
+  g_string_free (reply, TRUE);
+}
+
+/* Runs in a thread of the socket service, one per connection */
+static gboolean
+handle_connection (GThreadedSocketService *service,
+                   GSocketConnection      *connection,
+                   GObject                *source_object,
+                   gpointer                user_data)
+{
+  GDataInputStream *in;
+  GOutputStream    *out;
+  gchar            *line;
+
+  in  = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+  out = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  g_data_input_stream_set_newline_type (in, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+
+  while ((line = g_data_input_stream_read_line (in, NULL, NULL, NULL)))
+    {
+      g_strstrip (line);
+
+      if (!strcmp (line, "render"))
+        {
+          GString *body = g_string_new ("[request]\n");
+          gchar   *field;
+
+          while ((field = g_data_input_stream_read_line (in, NULL, NULL, NULL)))
+            {
+              gboolean end = !g_strstrip (field)[0];
+
+              if (!end)
+                g_string_append_printf (body, "%s\n", field);
+              g_free (field);
+              if (end)
+                break;
+            }
+
+          handle_render (out, body);
+          g_string_free (body, TRUE);
+        }
+      else if (!strcmp (line, "stats"))
+        {
+          handle_stats (out);
+        }
+      else if (line[0])
+        {
+          GString *reply = g_string_new (NULL);
+
+          g_string_printf (reply, "error unknown command %s\n\n", line);
+          send_string (out, reply);
+          g_string_free (reply, TRUE);
+        }
+
+      g_free (line);
+    }
+
+  g_object_unref (in);
+  return TRUE;
+}
+
+static gboolean
+quit_loop (gpointer data)
+{
+  g_main_loop_quit (data);
+  return G_SOURCE_REMOVE;
+}
+
+/* Removes a socket left over from a daemon that did not exit cleanly.
+ * Anything else at path, or a socket a daemon still answers on, fails.
+ */
+static gboolean
+claim_socket_path (const gchar  *path,
+                   GError      **error)
+{
+  GSocketClient     *client;
+  GSocketAddress    *address;
+  GSocketConnection *connection;
+  GStatBuf           st;
+
+  if (g_lstat (path, &st))
+    return TRUE;
+
+  if (!S_ISSOCK (st.st_mode))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_EXISTS,
+                   "%s exists and is not a socket, not removing it", path);
+      return FALSE;
+    }
+
+  client     = g_socket_client_new ();
+  address    = g_unix_socket_address_new (path);
+  connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address), NULL, NULL);
+  g_object_unref (address);
+  g_object_unref (client);
+
+  if (connection)
+    {
+      g_object_unref (connection);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_ADDRESS_IN_USE,
+                   "a daemon is already running on %s", path);
+      return FALSE;
+    }
+
+  if (g_unlink (path))
+    {
+      gint saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "%s: %s", path, g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GOptionContext  *context;
+  GSocketService  *service;
+  GSocketAddress  *address;
+  GMainLoop       *loop;
+  GError          *error = NULL;
+  gint             i;
+
+  context = g_option_context_new ("- serve rock text renders on a Unix socket");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gegl_get_option_group ());
+
+  if (!g_option_context_parse (context, &argc, &argv, &error) || argc != 1)
+    {
+      g_printerr ("%s\n", error ? error->message : "no arguments besides options");
+      g_printerr ("%s", g_option_context_get_help (context, TRUE, NULL));
+      return EXIT_FAILURE;
+    }
+
+  gegl_init (&argc, &argv);
+
+  if (!gegl_has_operation ("lb:rock-text"))
+    {
+      g_printerr ("lb:rock-text is not installed in the GEGL plug-ins folder\n");
+      gegl_exit ();
+      return EXIT_FAILURE;
+    }
+
+  if (n_threads <= 0)
+    n_threads = (gint) g_get_num_processors ();
+  if (!socket_path)
+    socket_path = g_build_filename (g_get_user_runtime_dir (), "rock-text.sock", NULL);
+
+  if (cache_dir)
+    {
+      cache = rock_cache_new (cache_dir, (guint64) MAX (cache_size, 1) << 20, &error);
+      if (!cache)
+        {
+          g_printerr ("%s\n", error->message);
+          g_clear_error (&error);
+          gegl_exit ();
+          return EXIT_FAILURE;
+        }
+    }
+
+  g_mutex_init (&stats.mutex);
+  idle_graphs = g_async_queue_new ();
+  for (i = 0; i < n_threads; i++)
+    g_async_queue_push (idle_graphs, rock_graph_new (FALSE));
+
+  if (!claim_socket_path (socket_path, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_clear_error (&error);
+      gegl_exit ();
+      return EXIT_FAILURE;
+    }
+
+  address = g_unix_socket_address_new (socket_path);
+  service = g_threaded_socket_service_new (max_clients);
+  if (!g_socket_listener_add_address (G_SOCKET_LISTENER (service), address,
+                                      G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                      NULL, NULL, &error))
+    {
+      g_printerr ("%s: %s\n", socket_path, error->message);
+      g_clear_error (&error);
+      g_object_unref (address);
+      g_object_unref (service);
+      gegl_exit ();
+      return EXIT_FAILURE;
+    }
+  g_object_unref (address);
+  g_chmod (socket_path, 0600);
+
+  g_signal_connect (service, "run", G_CALLBACK (handle_connection), NULL);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  g_unix_signal_add (SIGINT,  quit_loop, loop);
+  g_unix_signal_add (SIGTERM, quit_loop, loop);
+
+  stats.started = g_get_monotonic_time ();
+  g_socket_service_start (service);
+  g_print ("rock-text-daemon: %d graphs on %s\n", n_threads, socket_path);
+
+  g_main_loop_run (loop);
+
+  g_socket_service_stop (service);
+  g_socket_listener_close (G_SOCKET_LISTENER (service));
+  g_unlink (socket_path);
+
+  /* Waits for renders still running to hand their graph back */
+  for (i = 0; i < n_threads; i++)
+    rock_graph_free (g_async_queue_pop (idle_graphs));
+
+  g_object_unref (service);
+  g_main_loop_unref (loop);
+  g_async_queue_unref (idle_graphs);
+  rock_cache_free (cache);
+  g_option_context_free (context);
+  g_free (socket_path);
+  g_mutex_clear (&stats.mutex);
+  gegl_exit ();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+/* This file is part of the GEGL Rock Text command line tools
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Lists every link inside rock text, and inside the meta ops it contains, with the pixel format the
+producer writes and the format the consumer asked for. A link where they differ converts every pixel
+that crosses it with babl. The formats are the ones chosen by prepare(), so trace after a render.
+ */
+
+#include <gegl-plugin.h>
+#include "rock-job.h"
+
+static const gchar *
+format_name (const Babl *format)
+{
+  return format ? babl_get_name (format) : "?";
+}
+
+static void
+trace_node (GeglNode *node,
+            GString  *trace,
+            guint    *n_conversions,
+            gint      depth)
+{
+  static const gchar *pads[] = { "input", "aux" };
+  GSList *children = gegl_node_get_children (node);
+  GSList *iter;
+  guint   i;
+
+  for (iter = children; iter; iter = iter->next)
+    {
+      GeglNode      *child     = iter->data;
+      GeglOperation *operation = gegl_node_get_gegl_operation (child);
+      GSList        *grandchildren;
+
+      for (i = 0; i < G_N_ELEMENTS (pads); i++)
+        {
+          GeglNode      *producer;
+          GeglOperation *source;
+          gchar         *source_pad = NULL;
+          const Babl    *want, *have;
+          gboolean       convert;
+
+          if (!gegl_node_has_pad (child, pads[i]))
+            continue;
+
+          producer = gegl_node_get_producer (child, pads[i], &source_pad);
+          if (!producer)
+            continue;
+
+          source  = gegl_node_get_gegl_operation (producer);
+          want    = operation ? gegl_operation_get_format (operation, pads[i]) : NULL;
+          have    = source ? gegl_operation_get_format (source, source_pad) : NULL;
+          convert = want && have && want != have;
+          if (convert)
+            (*n_conversions)++;
+
+          g_string_append_printf (trace, "%*s%s -> %s.%s  %s -> %s%s\n",
+                                  2 * depth + 2, "",
+                                  gegl_node_get_operation (producer),
+                                  gegl_node_get_operation (child), pads[i],
+                                  format_name (have), format_name (want),
+                                  convert ? "  CONVERT" : "");
+          g_free (source_pad);
+        }
+
+      /* Meta ops like lb:edgesmooth have a graph of their own */
+      grandchildren = gegl_node_get_children (child);
+      if (grandchildren)
+        {
+          g_string_append_printf (trace, "%*s[%s]\n", 2 * depth + 2, "",
+                                  gegl_node_get_operation (child));
+          trace_node (child, trace, n_conversions, depth + 1);
+        }
+      g_slist_free (grandchildren);
+    }
+
+  g_slist_free (children);
+}
+
+guint
+rock_graph_trace_formats (RockGraph *rg,
+                          GString   *trace)
+{
+  guint n_conversions = 0;
+
+  trace_node (rg->rock, trace, &n_conversions, 0);
+
+  return n_conversions;
+}
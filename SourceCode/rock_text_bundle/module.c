@@ -0,0 +1,67 @@
+/* This file is an image processing operation for GEGL
+ *
+ * GEGL is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * GEGL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GEGL; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * Credit to Øyvind Kolås (pippin) for major GEGL contributions
+ * 2022 Beaver (GEGL rock text)
+ */
+
+/*
+Rock text, edgesmooth, port:load and the rock text helper ops in one GEGL module, so GEGL scans and
+loads one file instead of ten. Every op is compiled with GEGL_OP_BUNDLE, which makes gegl-op.h
+leave out the module entry points and export gegl_op_<name>_register_type instead; this file provides
+the entry points and registers them all. Install either this module or the separate ones, not both.
+ */
+
+#include "config.h"
+#include <glib-object.h>
+#include <gegl-plugin.h>
+
+#define ROCK_TEXT_OPS(OP) \
+  OP (rock_text)          \
+  OP (smoothedge)         \
+  OP (loadport)           \
+  OP (port_tiff_source)   \
+  OP (rock_colorize)      \
+  OP (rock_finish)        \
+  OP (rock_bevel)         \
+  OP (rock_outline)       \
+  OP (rock_upsample)      \
+  OP (rock_median)        \
+  OP (rock_spread)
+
+#define DECLARE_OP(name) void gegl_op_##name##_register_type (GTypeModule *module);
+ROCK_TEXT_OPS (DECLARE_OP)
+#undef DECLARE_OP
+
+static const GeglModuleInfo modinfo =
+{
+  GEGL_MODULE_ABI_VERSION
+};
+
+G_MODULE_EXPORT const GeglModuleInfo *
+gegl_module_query (GTypeModule *module)
+{
+  return &modinfo;
+}
+
+G_MODULE_EXPORT gboolean
+gegl_module_register (GTypeModule *module)
+{
+#define REGISTER_OP(name) gegl_op_##name##_register_type (module);
+  ROCK_TEXT_OPS (REGISTER_OP)
+#undef REGISTER_OP
+
+  return TRUE;
+}